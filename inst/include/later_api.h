@@ -29,6 +29,7 @@
 #include <pthread.h>
 #endif // _WIN32
 
+#include <stdint.h>
 #include <Rinternals.h>
 
 // ---- Public API ------------------------------------------------------------
@@ -45,7 +46,7 @@ namespace later {
 //
 // int (*dll_api_version)() = (int (*)()) R_GetCCallable("later", "apiVersion");
 // if (LATER_H_API_VERSION != (*dll_api_version)()) { ... }
-#define LATER_H_API_VERSION 3
+#define LATER_H_API_VERSION 4
 #define GLOBAL_LOOP 0
 
 
@@ -152,6 +153,382 @@ inline void later_fd(void (*func)(int *, void *), void *data, int num_fds, struc
   later_fd(func, data, num_fds, fds, secs, GLOBAL_LOOP);
 }
 
+// Flags for later_fd() and later_fd_watch(). With LATER_FD_REVENTS, `func` is
+// called on the raw revents of each file descriptor, as set by poll() (or
+// WSAPoll() on Windows), instead of 1 (ready), 0 (not ready) or NA_INTEGER
+// (error). If poll() itself fails, they're all NA_INTEGER.
+#define LATER_FD_REVENTS 1
+
+// # nocov start
+// tested by cpp-version-mismatch job on CI
+static void later_fd_flags_version_error(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, double secs, int loop_id, int flags) {
+  (void) func; (void) data; (void) num_fds; (void) fds; (void) secs; (void) loop_id; (void) flags;
+  (Rf_error)("later_fd called with flags, but installed version of the 'later' package is too old; please upgrade 'later' to 1.5.0 or above");
+}
+// # nocov end
+
+// Like later_fd(), with `flags` such as LATER_FD_REVENTS. Requires
+// later >= 1.5.0 (API version 4).
+inline void later_fd(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, double secs, int loop_id, int flags) {
+  // See above note for later()
+
+  // The function type for the real execLaterFdNative2
+  typedef void (*elfdn2fun)(void (*)(int *, void *), void *, int, struct pollfd *, double, int, int);
+  static elfdn2fun elfdn2 = NULL;
+  if (!elfdn2) {
+    // Initialize if necessary
+    if (func) {
+      // We're not initialized but someone's trying to actually schedule
+      // some code to be executed!
+      REprintf(
+        "Warning: later::execLaterFdNative2 called in uninitialized state.\n"
+      );
+    }
+    if (apiVersionRuntime() >= 4) {
+      // Only later API version 4 supports execLaterFdNative2
+      elfdn2 = (elfdn2fun) R_GetCCallable("later", "execLaterFdNative2");
+    } else {
+      // The installed version is too old and doesn't offer execLaterFdNative2.
+      elfdn2 = later_fd_flags_version_error;
+    }
+  }
+
+  // We didn't want to execute anything, just initialize
+  if (!func) {
+    return;
+  }
+
+  elfdn2(func, data, num_fds, fds, secs, loop_id, flags);
+}
+
+
+// ---- later_fd_watch() ------------------------------------------------------
+// Call a C function on the main R thread every time a file descriptor is
+// ready, until the watch is cancelled. Safe to call from any thread. Requires
+// later >= 1.5.0 (API version 4).
+
+// # nocov start
+// tested by cpp-version-mismatch job on CI
+static uint64_t later_fd_watch_version_error(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, int loop_id, int flags) {
+  (void) func; (void) data; (void) num_fds; (void) fds; (void) loop_id; (void) flags;
+  (Rf_error)("later_fd_watch called, but installed version of the 'later' package is too old; please upgrade 'later' to 1.5.0 or above");
+  return 0;
+}
+// # nocov end
+
+// Like later_fd(), but `func` is called every time any of the `num_fds` file
+// descriptors is ready, with the results as for later_fd() with the same
+// `flags`. The watch is level-triggered; its fds aren't watched while a call
+// to `func` is pending, so there's at most one at a time. Returns the ID of
+// the watch, to be passed to later_fd_unwatch(), or 0 if `num_fds` is 0 or
+// the loop does not exist.
+inline uint64_t later_fd_watch(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, int loop_id, int flags) {
+  // See above note for later()
+
+  // The function type for the real execLaterFdWatchNative
+  typedef uint64_t (*elfdwnfun)(void (*)(int *, void *), void *, int, struct pollfd *, int, int);
+  static elfdwnfun elfdwn = NULL;
+  if (!elfdwn) {
+    // Initialize if necessary
+    if (func) {
+      // We're not initialized but someone's trying to actually schedule
+      // some code to be executed!
+      REprintf(
+        "Warning: later::execLaterFdWatchNative called in uninitialized state.\n"
+      );
+    }
+    if (apiVersionRuntime() >= 4) {
+      // Only later API version 4 supports execLaterFdWatchNative
+      elfdwn = (elfdwnfun) R_GetCCallable("later", "execLaterFdWatchNative");
+    } else {
+      // The installed version is too old and doesn't offer execLaterFdWatchNative.
+      elfdwn = later_fd_watch_version_error;
+    }
+  }
+
+  // We didn't want to execute anything, just initialize
+  if (!func) {
+    return 0;
+  }
+
+  return elfdwn(func, data, num_fds, fds, loop_id, flags);
+}
+
+inline uint64_t later_fd_watch(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, int loop_id) {
+  return later_fd_watch(func, data, num_fds, fds, loop_id, 0);
+}
+
+inline uint64_t later_fd_watch(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds) {
+  return later_fd_watch(func, data, num_fds, fds, GLOBAL_LOOP, 0);
+}
+
+// # nocov start
+// tested by cpp-version-mismatch job on CI
+static int later_fd_unwatch_version_error(uint64_t id) {
+  (void) id;
+  (Rf_error)("later_fd_unwatch called, but installed version of the 'later' package is too old; please upgrade 'later' to 1.5.0 or above");
+  return 0;
+}
+// # nocov end
+
+// Cancels a watch started with later_fd_watch(). Must be called from the main
+// R thread. Returns true if the watch was cancelled, and false if it had been
+// cancelled already or the ID is unknown.
+inline bool later_fd_unwatch(uint64_t id) {
+  // The function type for the real execLaterFdUnwatchNative
+  typedef int (*elfdunfun)(uint64_t);
+  static elfdunfun elfdun = NULL;
+  if (!elfdun) {
+    if (apiVersionRuntime() >= 4) {
+      // Only later API version 4 supports execLaterFdUnwatchNative
+      elfdun = (elfdunfun) R_GetCCallable("later", "execLaterFdUnwatchNative");
+    } else {
+      // The installed version is too old and doesn't offer execLaterFdUnwatchNative.
+      elfdun = later_fd_unwatch_version_error;
+    }
+  }
+
+  // An ID of 0 is never used for a watch; it's only used to initialize.
+  if (id == 0) {
+    return false;
+  }
+
+  return elfdun(id) != 0;
+}
+
+
+// ---- later_read() ----------------------------------------------------------
+// Call a C function on the main R thread with the bytes read from a file
+// descriptor once it's readable. Safe to call from any thread. Requires
+// later >= 1.5.0 (API version 4).
+
+// # nocov start
+// tested by cpp-version-mismatch job on CI
+static int later_read_version_error(void (*func)(const char *, int, void *), void *data, int fd, int max_bytes, double secs, int loop_id) {
+  (void) func; (void) data; (void) fd; (void) max_bytes; (void) secs; (void) loop_id;
+  (Rf_error)("later_read called, but installed version of the 'later' package is too old; please upgrade 'later' to 1.5.0 or above");
+  return 1;
+}
+// # nocov end
+
+// Waits up to `secs` seconds for `fd` to be readable, then reads at most
+// `max_bytes` from it on the waiting thread, and calls `func` on the main R
+// thread with the bytes and their number. The bytes are only valid during the
+// call. The number is 0 at end of file, -ETIMEDOUT if the wait timed out, or
+// a negative errno if the read failed. Returns false if the wait couldn't be
+// started.
+inline bool later_read(void (*func)(const char *, int, void *), void *data, int fd, int max_bytes, double secs, int loop_id) {
+  // See above note for later()
+
+  // The function type for the real execLaterReadNative
+  typedef int (*elrnfun)(void (*)(const char *, int, void *), void *, int, int, double, int);
+  static elrnfun elrn = NULL;
+  if (!elrn) {
+    // Initialize if necessary
+    if (func) {
+      // We're not initialized but someone's trying to actually schedule
+      // some code to be executed!
+      REprintf(
+        "Warning: later::execLaterReadNative called in uninitialized state.\n"
+      );
+    }
+    if (apiVersionRuntime() >= 4) {
+      // Only later API version 4 supports execLaterReadNative
+      elrn = (elrnfun) R_GetCCallable("later", "execLaterReadNative");
+    } else {
+      // The installed version is too old and doesn't offer execLaterReadNative.
+      elrn = later_read_version_error;
+    }
+  }
+
+  // We didn't want to execute anything, just initialize
+  if (!func) {
+    return false;
+  }
+
+  return elrn(func, data, fd, max_bytes, secs, loop_id) == 0;
+}
+
+inline bool later_read(void (*func)(const char *, int, void *), void *data, int fd, int max_bytes, double secs) {
+  return later_read(func, data, fd, max_bytes, secs, GLOBAL_LOOP);
+}
+
+
+// ---- later_batch() ---------------------------------------------------------
+// Schedule several C functions at once. Safe to call from any thread.
+// Requires later >= 1.5.0 (API version 4).
+
+// One callback to be scheduled with later_batch(): the function, the data
+// pointer passed to it, and the number of seconds to wait before calling it.
+struct batch_item {
+  void (*func)(void*);
+  void* data;
+  double secs;
+};
+
+// # nocov start
+// tested by cpp-version-mismatch job on CI
+static int later_batch_version_error(const batch_item* items, int n, uint64_t* ids, int loop_id) {
+  (void) items; (void) n; (void) ids; (void) loop_id;
+  (Rf_error)("later_batch called, but installed version of the 'later' package is too old; please upgrade 'later' to 1.5.0 or above");
+  return 0;
+}
+// # nocov end
+
+// Schedules the `n` callbacks in `items` on the given loop. This is
+// equivalent to calling later() once for each item, but it is cheaper: the
+// callbacks are handed to the event loop together, and the loop is woken up
+// at most once.
+//
+// If `ids` is not NULL, it must have room for `n` values; the ID of each
+// callback is written to it. Returns the number of callbacks scheduled, which
+// is 0 if the loop does not exist.
+inline int later_batch(const batch_item* items, int n, uint64_t* ids, int loop_id) {
+  // See above note for later()
+
+  // The function type for the real execLaterBatchNative
+  typedef int (*elbnfun)(const batch_item*, int, uint64_t*, int);
+  static elbnfun elbn = NULL;
+  if (!elbn) {
+    // Initialize if necessary
+    if (items) {
+      // We're not initialized but someone's trying to actually schedule
+      // some code to be executed!
+      REprintf(
+        "Warning: later::execLaterBatchNative called in uninitialized state.\n"
+      );
+    }
+    if (apiVersionRuntime() >= 4) {
+      // Only later API version 4 supports execLaterBatchNative
+      elbn = (elbnfun) R_GetCCallable("later", "execLaterBatchNative");
+    } else {
+      // The installed version is too old and doesn't offer execLaterBatchNative.
+      elbn = later_batch_version_error;
+    }
+  }
+
+  // We didn't want to execute anything, just initialize
+  if (!items) {
+    return 0;
+  }
+
+  return elbn(items, n, ids, loop_id);
+}
+
+inline int later_batch(const batch_item* items, int n, uint64_t* ids) {
+  return later_batch(items, n, ids, GLOBAL_LOOP);
+}
+
+
+// ---- later_every() ---------------------------------------------------------
+// Schedule a C function to execute repeatedly on the main R thread. Safe to
+// call from any thread. Requires later >= 1.5.0 (API version 4).
+
+// What a repeating callback does if it falls behind, so that one or more of
+// its deadlines have passed by the time it finishes running.
+enum missed_tick_policy {
+  // Drop the missed deadlines, and run at the next deadline in the future.
+  missed_skip = 0,
+  // Run once right away for all of the missed deadlines.
+  missed_coalesce = 1,
+  // Run once for every missed deadline, as soon as possible.
+  missed_catch_up = 2
+};
+
+// # nocov start
+// tested by cpp-version-mismatch job on CI
+static uint64_t later_every_version_error(void (*func)(void*), void* data, double interval, double secs, int missed, int loop_id) {
+  (void) func; (void) data; (void) interval; (void) secs; (void) missed; (void) loop_id;
+  (Rf_error)("later_every called, but installed version of the 'later' package is too old; please upgrade 'later' to 1.5.0 or above");
+  return 0;
+}
+// # nocov end
+
+// Calls `func(data)` after `secs` seconds, and then every `interval` seconds
+// until it is cancelled with later_cancel(). Each deadline is `interval`
+// seconds after the previous one, no matter how long `func` takes to run.
+// The same callback ID is used for every run. Returns the callback ID, or 0
+// if the loop does not exist or `interval` is not positive.
+inline uint64_t later_every(void (*func)(void*), void* data, double interval, double secs,
+                            missed_tick_policy missed, int loop_id) {
+  // See above note for later()
+
+  // The function type for the real execLaterEveryNative
+  typedef uint64_t (*elenfun)(void (*)(void*), void*, double, double, int, int);
+  static elenfun elen = NULL;
+  if (!elen) {
+    // Initialize if necessary
+    if (func) {
+      // We're not initialized but someone's trying to actually schedule
+      // some code to be executed!
+      REprintf(
+        "Warning: later::execLaterEveryNative called in uninitialized state.\n"
+      );
+    }
+    if (apiVersionRuntime() >= 4) {
+      // Only later API version 4 supports execLaterEveryNative
+      elen = (elenfun) R_GetCCallable("later", "execLaterEveryNative");
+    } else {
+      // The installed version is too old and doesn't offer execLaterEveryNative.
+      elen = later_every_version_error;
+    }
+  }
+
+  // We didn't want to execute anything, just initialize
+  if (!func) {
+    return 0;
+  }
+
+  return elen(func, data, interval, secs, (int) missed, loop_id);
+}
+
+inline uint64_t later_every(void (*func)(void*), void* data, double interval, double secs = 0,
+                            missed_tick_policy missed = missed_skip) {
+  return later_every(func, data, interval, secs, missed, GLOBAL_LOOP);
+}
+
+
+// ---- later_cancel() --------------------------------------------------------
+// Cancel a callback scheduled with later_every() or later_batch(). Must be
+// called from the main R thread. Requires later >= 1.5.0 (API version 4).
+
+// # nocov start
+// tested by cpp-version-mismatch job on CI
+static int later_cancel_version_error(uint64_t id, int loop_id) {
+  (void) id; (void) loop_id;
+  (Rf_error)("later_cancel called, but installed version of the 'later' package is too old; please upgrade 'later' to 1.5.0 or above");
+  return 0;
+}
+// # nocov end
+
+// Returns true if the callback was cancelled, and false if it had already run
+// or been cancelled, or the loop does not exist.
+inline bool later_cancel(uint64_t id, int loop_id) {
+  // The function type for the real execLaterCancelNative
+  typedef int (*elcnfun)(uint64_t, int);
+  static elcnfun elcn = NULL;
+  if (!elcn) {
+    if (apiVersionRuntime() >= 4) {
+      // Only later API version 4 supports execLaterCancelNative
+      elcn = (elcnfun) R_GetCCallable("later", "execLaterCancelNative");
+    } else {
+      // The installed version is too old and doesn't offer execLaterCancelNative.
+      elcn = later_cancel_version_error;
+    }
+  }
+
+  // An ID of 0 is never used for a callback; it's only used to initialize.
+  if (id == 0) {
+    return false;
+  }
+
+  return elcn(id, loop_id) != 0;
+}
+
+inline bool later_cancel(uint64_t id) {
+  return later_cancel(id, GLOBAL_LOOP);
+}
+
 
 // ---- BackgroundTask --------------------------------------------------------
 // Helper class for running work on a background thread and returning results
@@ -224,8 +601,10 @@ private:
 } // namespace later
 
 // ---- Static initialization -------------------------------------------------
-// Ensures later() and later_fd() are initialized on the main R thread before
-// any user code can call them from a background thread.
+// Ensures later(), later_fd(), later_fd_watch(), later_fd_unwatch(),
+// later_read(), later_batch(), later_every() and later_cancel() are
+// initialized on the main R thread before any user code can call them from a
+// background thread.
 
 namespace {
 
@@ -236,6 +615,13 @@ public:
     // in a statically initialized object
     later::later(NULL, NULL, 0);
     later::later_fd(NULL, NULL, 0, NULL, 0);
+    later::later_fd(NULL, NULL, 0, NULL, 0, GLOBAL_LOOP, 0);
+    later::later_fd_watch(NULL, NULL, 0, NULL);
+    later::later_fd_unwatch(0);
+    later::later_read(NULL, NULL, 0, 0, 0);
+    later::later_batch(NULL, 0, NULL);
+    later::later_every(NULL, NULL, 0);
+    later::later_cancel(0);
   }
 };
 
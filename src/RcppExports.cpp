@@ -38,8 +38,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // execLater_fd
-Rcpp::RObject execLater_fd(Rcpp::Function callback, Rcpp::IntegerVector readfds, Rcpp::IntegerVector writefds, Rcpp::IntegerVector exceptfds, Rcpp::NumericVector timeoutSecs, Rcpp::IntegerVector loop_id);
-RcppExport SEXP _later_execLater_fd(SEXP callbackSEXP, SEXP readfdsSEXP, SEXP writefdsSEXP, SEXP exceptfdsSEXP, SEXP timeoutSecsSEXP, SEXP loop_idSEXP) {
+Rcpp::RObject execLater_fd(Rcpp::Function callback, Rcpp::IntegerVector readfds, Rcpp::IntegerVector writefds, Rcpp::IntegerVector exceptfds, Rcpp::NumericVector timeoutSecs, Rcpp::IntegerVector loop_id, bool revents);
+RcppExport SEXP _later_execLater_fd(SEXP callbackSEXP, SEXP readfdsSEXP, SEXP writefdsSEXP, SEXP exceptfdsSEXP, SEXP timeoutSecsSEXP, SEXP loop_idSEXP, SEXP reventsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::traits::input_parameter< Rcpp::Function >::type callback(callbackSEXP);
@@ -48,7 +48,63 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type exceptfds(exceptfdsSEXP);
     Rcpp::traits::input_parameter< Rcpp::NumericVector >::type timeoutSecs(timeoutSecsSEXP);
     Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type loop_id(loop_idSEXP);
-    rcpp_result_gen = Rcpp::wrap(execLater_fd(callback, readfds, writefds, exceptfds, timeoutSecs, loop_id));
+    Rcpp::traits::input_parameter< bool >::type revents(reventsSEXP);
+    rcpp_result_gen = Rcpp::wrap(execLater_fd(callback, readfds, writefds, exceptfds, timeoutSecs, loop_id, revents));
+    return rcpp_result_gen;
+END_RCPP
+}
+// execLater_fd_watch
+Rcpp::RObject execLater_fd_watch(Rcpp::Function callback, Rcpp::IntegerVector readfds, Rcpp::IntegerVector writefds, Rcpp::IntegerVector exceptfds, Rcpp::IntegerVector loop_id, bool revents);
+RcppExport SEXP _later_execLater_fd_watch(SEXP callbackSEXP, SEXP readfdsSEXP, SEXP writefdsSEXP, SEXP exceptfdsSEXP, SEXP loop_idSEXP, SEXP reventsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< Rcpp::Function >::type callback(callbackSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type readfds(readfdsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type writefds(writefdsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type exceptfds(exceptfdsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector >::type loop_id(loop_idSEXP);
+    Rcpp::traits::input_parameter< bool >::type revents(reventsSEXP);
+    rcpp_result_gen = Rcpp::wrap(execLater_fd_watch(callback, readfds, writefds, exceptfds, loop_id, revents));
+    return rcpp_result_gen;
+END_RCPP
+}
+// execLater_read
+Rcpp::RObject execLater_read(Rcpp::Function callback, int fd, int n, double timeoutSecs, int loop_id);
+RcppExport SEXP _later_execLater_read(SEXP callbackSEXP, SEXP fdSEXP, SEXP nSEXP, SEXP timeoutSecsSEXP, SEXP loop_idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< Rcpp::Function >::type callback(callbackSEXP);
+    Rcpp::traits::input_parameter< int >::type fd(fdSEXP);
+    Rcpp::traits::input_parameter< int >::type n(nSEXP);
+    Rcpp::traits::input_parameter< double >::type timeoutSecs(timeoutSecsSEXP);
+    Rcpp::traits::input_parameter< int >::type loop_id(loop_idSEXP);
+    rcpp_result_gen = Rcpp::wrap(execLater_read(callback, fd, n, timeoutSecs, loop_id));
+    return rcpp_result_gen;
+END_RCPP
+}
+// execLater_pid
+Rcpp::RObject execLater_pid(Rcpp::Function callback, int pid, double timeoutSecs, int loop_id);
+RcppExport SEXP _later_execLater_pid(SEXP callbackSEXP, SEXP pidSEXP, SEXP timeoutSecsSEXP, SEXP loop_idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< Rcpp::Function >::type callback(callbackSEXP);
+    Rcpp::traits::input_parameter< int >::type pid(pidSEXP);
+    Rcpp::traits::input_parameter< double >::type timeoutSecs(timeoutSecsSEXP);
+    Rcpp::traits::input_parameter< int >::type loop_id(loop_idSEXP);
+    rcpp_result_gen = Rcpp::wrap(execLater_pid(callback, pid, timeoutSecs, loop_id));
+    return rcpp_result_gen;
+END_RCPP
+}
+// execLater_file
+Rcpp::RObject execLater_file(Rcpp::Function callback, std::vector<std::string> paths, double window, int loop_id);
+RcppExport SEXP _later_execLater_file(SEXP callbackSEXP, SEXP pathsSEXP, SEXP windowSEXP, SEXP loop_idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< Rcpp::Function >::type callback(callbackSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type paths(pathsSEXP);
+    Rcpp::traits::input_parameter< double >::type window(windowSEXP);
+    Rcpp::traits::input_parameter< int >::type loop_id(loop_idSEXP);
+    rcpp_result_gen = Rcpp::wrap(execLater_file(callback, paths, window, loop_id));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -62,6 +118,26 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// file_cancel
+Rcpp::LogicalVector file_cancel(Rcpp::RObject xptr);
+RcppExport SEXP _later_file_cancel(SEXP xptrSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< Rcpp::RObject >::type xptr(xptrSEXP);
+    rcpp_result_gen = Rcpp::wrap(file_cancel(xptr));
+    return rcpp_result_gen;
+END_RCPP
+}
+// fd_backend
+std::string fd_backend(std::string backend);
+RcppExport SEXP _later_fd_backend(SEXP backendSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< std::string >::type backend(backendSEXP);
+    rcpp_result_gen = Rcpp::wrap(fd_backend(backend));
+    return rcpp_result_gen;
+END_RCPP
+}
 // setCurrentRegistryId
 void setCurrentRegistryId(int id);
 RcppExport SEXP _later_setCurrentRegistryId(SEXP idSEXP) {
@@ -101,12 +177,13 @@ BEGIN_RCPP
 END_RCPP
 }
 // createCallbackRegistry
-void createCallbackRegistry(int id, int parent_id);
-RcppExport SEXP _later_createCallbackRegistry(SEXP idSEXP, SEXP parent_idSEXP) {
+void createCallbackRegistry(int id, int parent_id, std::string queue_type);
+RcppExport SEXP _later_createCallbackRegistry(SEXP idSEXP, SEXP parent_idSEXP, SEXP queue_typeSEXP) {
 BEGIN_RCPP
     Rcpp::traits::input_parameter< int >::type id(idSEXP);
     Rcpp::traits::input_parameter< int >::type parent_id(parent_idSEXP);
-    createCallbackRegistry(id, parent_id);
+    Rcpp::traits::input_parameter< std::string >::type queue_type(queue_typeSEXP);
+    createCallbackRegistry(id, parent_id, queue_type);
     return R_NilValue;
 END_RCPP
 }
@@ -130,6 +207,36 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// callbackPoolStats
+Rcpp::NumericVector callbackPoolStats(int loop_id);
+RcppExport SEXP _later_callbackPoolStats(SEXP loop_idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< int >::type loop_id(loop_idSEXP);
+    rcpp_result_gen = Rcpp::wrap(callbackPoolStats(loop_id));
+    return rcpp_result_gen;
+END_RCPP
+}
+// setLoopSlack
+double setLoopSlack(int loop_id, double secs);
+RcppExport SEXP _later_setLoopSlack(SEXP loop_idSEXP, SEXP secsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< int >::type loop_id(loop_idSEXP);
+    Rcpp::traits::input_parameter< double >::type secs(secsSEXP);
+    rcpp_result_gen = Rcpp::wrap(setLoopSlack(loop_id, secs));
+    return rcpp_result_gen;
+END_RCPP
+}
+// autorunnerStats
+Rcpp::NumericVector autorunnerStats();
+RcppExport SEXP _later_autorunnerStats() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    rcpp_result_gen = Rcpp::wrap(autorunnerStats());
+    return rcpp_result_gen;
+END_RCPP
+}
 // execCallbacks
 bool execCallbacks(double timeoutSecs, bool runAll, int loop_id);
 RcppExport SEXP _later_execCallbacks(SEXP timeoutSecsSEXP, SEXP runAllSEXP, SEXP loop_idSEXP) {
@@ -142,6 +249,20 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// execCallbacksBudget
+Rcpp::List execCallbacksBudget(double timeoutSecs, bool runAll, int loop_id, double budgetSecs, double maxCallbacks);
+RcppExport SEXP _later_execCallbacksBudget(SEXP timeoutSecsSEXP, SEXP runAllSEXP, SEXP loop_idSEXP, SEXP budgetSecsSEXP, SEXP maxCallbacksSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< double >::type timeoutSecs(timeoutSecsSEXP);
+    Rcpp::traits::input_parameter< bool >::type runAll(runAllSEXP);
+    Rcpp::traits::input_parameter< int >::type loop_id(loop_idSEXP);
+    Rcpp::traits::input_parameter< double >::type budgetSecs(budgetSecsSEXP);
+    Rcpp::traits::input_parameter< double >::type maxCallbacks(maxCallbacksSEXP);
+    rcpp_result_gen = Rcpp::wrap(execCallbacksBudget(timeoutSecs, runAll, loop_id, budgetSecs, maxCallbacks));
+    return rcpp_result_gen;
+END_RCPP
+}
 // idle
 bool idle(int loop_id);
 RcppExport SEXP _later_idle(SEXP loop_idSEXP) {
@@ -172,6 +293,32 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// execLaterEvery
+std::string execLaterEvery(Rcpp::Function callback, double intervalSecs, double delaySecs, std::string missed, int loop_id);
+RcppExport SEXP _later_execLaterEvery(SEXP callbackSEXP, SEXP intervalSecsSEXP, SEXP delaySecsSEXP, SEXP missedSEXP, SEXP loop_idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< Rcpp::Function >::type callback(callbackSEXP);
+    Rcpp::traits::input_parameter< double >::type intervalSecs(intervalSecsSEXP);
+    Rcpp::traits::input_parameter< double >::type delaySecs(delaySecsSEXP);
+    Rcpp::traits::input_parameter< std::string >::type missed(missedSEXP);
+    Rcpp::traits::input_parameter< int >::type loop_id(loop_idSEXP);
+    rcpp_result_gen = Rcpp::wrap(execLaterEvery(callback, intervalSecs, delaySecs, missed, loop_id));
+    return rcpp_result_gen;
+END_RCPP
+}
+// execLaterMany
+std::vector<std::string> execLaterMany(Rcpp::List callbacks, Rcpp::NumericVector delaySecs, int loop_id);
+RcppExport SEXP _later_execLaterMany(SEXP callbacksSEXP, SEXP delaySecsSEXP, SEXP loop_idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< Rcpp::List >::type callbacks(callbacksSEXP);
+    Rcpp::traits::input_parameter< Rcpp::NumericVector >::type delaySecs(delaySecsSEXP);
+    Rcpp::traits::input_parameter< int >::type loop_id(loop_idSEXP);
+    rcpp_result_gen = Rcpp::wrap(execLaterMany(callbacks, delaySecs, loop_id));
+    return rcpp_result_gen;
+END_RCPP
+}
 // cancel
 bool cancel(std::string callback_id_s, int loop_id);
 RcppExport SEXP _later_cancel(SEXP callback_id_sSEXP, SEXP loop_idSEXP) {
@@ -183,6 +330,17 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// cancelMany
+std::vector<bool> cancelMany(std::vector<std::string> callback_ids_s, int loop_id);
+RcppExport SEXP _later_cancelMany(SEXP callback_ids_sSEXP, SEXP loop_idSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type callback_ids_s(callback_ids_sSEXP);
+    Rcpp::traits::input_parameter< int >::type loop_id(loop_idSEXP);
+    rcpp_result_gen = Rcpp::wrap(cancelMany(callback_ids_s, loop_id));
+    return rcpp_result_gen;
+END_RCPP
+}
 // nextOpSecs
 double nextOpSecs(int loop_id);
 RcppExport SEXP _later_nextOpSecs(SEXP loop_idSEXP) {
@@ -0,0 +1,121 @@
+#include "callback_ingress.h"
+#include "tinycthread.h"
+
+// A timestamp later than any callback can be scheduled for.
+static const double NEVER_SECS = 1e300;
+
+CallbackIngress::CallbackIngress()
+  : head(&stub), tail(&stub), wakeAt(Timestamp(NEVER_SECS)), isClosed(false)
+{
+}
+
+CallbackIngress::~CallbackIngress() {
+  // Free any callbacks that were never drained. This can happen if the loop
+  // is destroyed while a background thread is scheduling callbacks on it.
+  while (pop() != nullptr) {
+  }
+}
+
+bool CallbackIngress::push(const Callback_sp& cb) {
+  Node* node = new Node();
+  node->callback = cb;
+  return pushChain(node, node, cb->when);
+}
+
+bool CallbackIngress::push(const std::vector<Callback_sp>& callbacks) {
+  if (callbacks.empty()) {
+    return false;
+  }
+
+  Node* first = new Node();
+  first->callback = callbacks[0];
+  Node* last = first;
+  Timestamp earliest = callbacks[0]->when;
+  for (size_t i = 1; i < callbacks.size(); i++) {
+    Node* node = new Node();
+    node->callback = callbacks[i];
+    last->next.store(node);
+    last = node;
+    if (callbacks[i]->when < earliest) {
+      earliest = callbacks[i]->when;
+    }
+  }
+  return pushChain(first, last, earliest);
+}
+
+bool CallbackIngress::pushChain(Node* first, Node* last, const Timestamp& earliest) {
+  Node* prev = head.exchange(last);
+  // Between the exchange and this store, the nodes are not reachable by the
+  // consumer. pop() waits for the store if it gets there first.
+  prev->next.store(first);
+
+  // The nodes must be linked before updating wakeAt; see resetWakeup().
+  Timestamp cur = wakeAt.load();
+  while (earliest < cur) {
+    if (wakeAt.compare_exchange_weak(cur, earliest)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+Callback_sp CallbackIngress::pop() {
+  Node* t = tail;
+  Node* next = t->next.load();
+
+  if (t == &stub) {
+    if (next == nullptr) {
+      if (head.load() == &stub) {
+        return Callback_sp();
+      }
+      // A producer has swapped in a new head but hasn't linked the stub to
+      // it yet. It's in the middle of two consecutive statements, so just
+      // wait for it.
+      while ((next = t->next.load()) == nullptr) {
+        tct_thrd_yield();
+      }
+    }
+    tail = next;
+    t = next;
+    next = t->next.load();
+  }
+
+  if (next == nullptr) {
+    if (head.load() != t) {
+      // As above: another node is being pushed after this one.
+      while ((next = t->next.load()) == nullptr) {
+        tct_thrd_yield();
+      }
+    } else {
+      // This is the last node. Put the stub back behind it so that the node
+      // can be removed without leaving the queue empty.
+      stub.next.store(nullptr);
+      Node* prev = head.exchange(&stub);
+      prev->next.store(&stub);
+      while ((next = t->next.load()) == nullptr) {
+        tct_thrd_yield();
+      }
+    }
+  }
+
+  tail = next;
+  Callback_sp result = t->callback;
+  delete t;
+  return result;
+}
+
+void CallbackIngress::resetWakeup() {
+  // This is called before the consumer pops. Any producer that updated
+  // wakeAt before this point had already linked its node, so the consumer
+  // will see that node. Any producer that comes after will find wakeAt
+  // reset and wake the consumer up again.
+  wakeAt.store(Timestamp(NEVER_SECS));
+}
+
+void CallbackIngress::close() {
+  isClosed.store(true);
+}
+
+bool CallbackIngress::closed() const {
+  return isClosed.load();
+}
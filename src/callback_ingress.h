@@ -0,0 +1,92 @@
+#ifndef _CALLBACK_INGRESS_H_
+#define _CALLBACK_INGRESS_H_
+
+#include <atomic>
+#include <vector>
+#include "callback_registry.h"
+#include "timestamp.h"
+
+// ============================================================================
+// CallbackIngress
+// ============================================================================
+//
+// A lock-free, multi-producer, single-consumer queue of callbacks that have
+// been scheduled on a loop but not yet inserted into its CallbackQueue.
+//
+// When C/C++ code schedules a callback from a background thread (via
+// execLaterNative2()), it pushes the callback here instead of taking the
+// global lock and inserting it into the ordered queue directly. The
+// CallbackRegistry moves the callbacks into its ordered queue ("drains" the
+// ingress) whenever it is about to look at the queue, with the global lock
+// held, so there is only ever one consumer at a time.
+//
+// Callback IDs and timestamps are assigned by the producer when the Callback
+// object is created, so callbacks end up in the same (timestamp, ID) order
+// as if they had been inserted directly.
+//
+// This is the intrusive MPSC queue described by Dmitry Vyukov: producers
+// atomically swap themselves in as the new head and then link the previous
+// head to themselves; the consumer follows the links from the tail.
+class CallbackIngress {
+public:
+  CallbackIngress();
+  ~CallbackIngress();
+
+  // Make non-copyable
+  CallbackIngress(const CallbackIngress&) = delete;
+  CallbackIngress& operator=(const CallbackIngress&) = delete;
+
+  // Add a callback. Can be called from any thread. Returns true if the
+  // caller needs to wake up whatever runs the loop, because the callback is
+  // due earlier than anything else pushed since the last drain.
+  bool push(const Callback_sp& cb);
+
+  // Add several callbacks at once. They are linked together first and then
+  // made visible to the consumer with a single atomic operation, so they
+  // stay together and in order. The return value is as for push().
+  bool push(const std::vector<Callback_sp>& callbacks);
+
+  // Remove and return the oldest callback, or an empty pointer if the queue
+  // is empty. Must only be called by one thread at a time.
+  Callback_sp pop();
+
+  // Called by the consumer before popping, to indicate that everything
+  // pushed up to now is about to be seen, so later pushes need to wake it up
+  // again.
+  void resetWakeup();
+
+  // Mark the ingress as belonging to a loop that has been removed from the
+  // CallbackRegistryTable. Nothing pushed from then on will run. Called on
+  // the main thread, with the global lock held.
+  void close();
+
+  // Has close() been called? A producer checks this after pushing, so that
+  // it can tell its caller that the callback wasn't scheduled.
+  bool closed() const;
+
+private:
+  struct Node {
+    Node() : next(nullptr) {}
+    std::atomic<Node*> next;
+    Callback_sp callback;
+  };
+
+  // Append the chain of nodes from `first` to `last`, which must already be
+  // linked together, and update wakeAt.
+  bool pushChain(Node* first, Node* last, const Timestamp& earliest);
+
+  // Producers push at the head, and the consumer pops from the tail.
+  std::atomic<Node*> head;
+  Node* tail;
+  // Placeholder node which is re-inserted whenever the queue would otherwise
+  // be left without any nodes.
+  Node stub;
+
+  // The earliest time that a producer has asked for the loop to be woken up
+  // for, since the last call to resetWakeup().
+  std::atomic<Timestamp> wakeAt;
+
+  std::atomic<bool> isClosed;
+};
+
+#endif // _CALLBACK_INGRESS_H_
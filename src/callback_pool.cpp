@@ -0,0 +1,78 @@
+#include "callback_pool.h"
+
+thread_local bool CallbackPool::poolThread = false;
+
+CallbackPool::CallbackPool() : mutex(tct_mtx_plain) {
+  poolThread = true;
+  for (size_t i = 0; i < SIZE_CLASSES; i++) {
+    freeLists[i] = nullptr;
+  }
+  counts.allocations = 0;
+  counts.deallocations = 0;
+  counts.heapAllocations = 0;
+}
+
+CallbackPool::~CallbackPool() {
+  for (size_t i = 0; i < slabs.size(); i++) {
+    ::operator delete(slabs[i]);
+  }
+}
+
+void* CallbackPool::allocate(size_t size) {
+  if (size == 0 || size > MAX_SIZE) {
+    Guard guard(&mutex);
+    counts.allocations++;
+    counts.heapAllocations++;
+    return ::operator new(size);
+  }
+
+  size_t cls = (size - 1) / ALIGN;
+  Guard guard(&mutex);
+  counts.allocations++;
+
+  if (freeLists[cls] == nullptr) {
+    // Carve a new slab into blocks of this size class, and put them all on
+    // the free list.
+    size_t blockSize = (cls + 1) * ALIGN;
+    char* slab = static_cast<char*>(::operator new(blockSize * BLOCKS_PER_SLAB));
+    slabs.push_back(slab);
+    counts.heapAllocations++;
+
+    for (size_t i = 0; i < BLOCKS_PER_SLAB; i++) {
+      FreeBlock* block = reinterpret_cast<FreeBlock*>(slab + i * blockSize);
+      block->next = freeLists[cls];
+      freeLists[cls] = block;
+    }
+  }
+
+  FreeBlock* block = freeLists[cls];
+  freeLists[cls] = block->next;
+  return block;
+}
+
+void CallbackPool::deallocate(void* p, size_t size) {
+  if (size == 0 || size > MAX_SIZE) {
+    {
+      Guard guard(&mutex);
+      counts.deallocations++;
+    }
+    ::operator delete(p);
+    return;
+  }
+
+  size_t cls = (size - 1) / ALIGN;
+  FreeBlock* block = static_cast<FreeBlock*>(p);
+  Guard guard(&mutex);
+  counts.deallocations++;
+  block->next = freeLists[cls];
+  freeLists[cls] = block;
+}
+
+CallbackPoolStats CallbackPool::stats() const {
+  Guard guard(&mutex);
+  return counts;
+}
+
+bool CallbackPool::onPoolThread() {
+  return poolThread;
+}
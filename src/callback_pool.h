@@ -0,0 +1,131 @@
+#ifndef _CALLBACK_POOL_H_
+#define _CALLBACK_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include "threadutils.h"
+
+// ============================================================================
+// CallbackPool
+// ============================================================================
+//
+// A memory pool for Callback objects. Each CallbackRegistry has one, and every
+// callback scheduled on the registry is allocated from it, with
+// std::allocate_shared() and a PoolAllocator. That puts the Callback object
+// and the shared_ptr control block in a single block from the pool.
+//
+// Blocks are carved out of larger slabs and are never returned to the system
+// while the pool exists; freed blocks go on a free list for their size class
+// and are reused by later allocations.
+//
+// Only the main thread, which creates the pools, allocates from them.
+// Callbacks scheduled from other threads (e.g. by httpuv or promises, many at
+// once) are allocated by allocate_callback() with the system allocator, which
+// already caches memory per thread, so that those threads don't serialize on
+// the pool. A callback from the pool can still be freed on another thread,
+// so the free lists are protected by a mutex, but it's rarely contended.
+//
+// The pool is reference counted. Each allocated block holds a reference (in
+// the allocator stored in the shared_ptr control block), so a pool outlives
+// all of the callbacks allocated from it, even if the registry is destroyed
+// first.
+
+struct CallbackPoolStats {
+  // Number of blocks handed out by the pool.
+  uint64_t allocations;
+  // Number of blocks given back to the pool.
+  uint64_t deallocations;
+  // Number of calls the pool made to the system allocator: one per slab, plus
+  // one per allocation too large for the pool.
+  uint64_t heapAllocations;
+};
+
+class CallbackPool {
+public:
+  CallbackPool();
+  ~CallbackPool();
+
+  // Make non-copyable
+  CallbackPool(const CallbackPool&) = delete;
+  CallbackPool& operator=(const CallbackPool&) = delete;
+
+  void* allocate(size_t size);
+  void deallocate(void* p, size_t size);
+
+  CallbackPoolStats stats() const;
+
+  // Is this the thread that pools are allocated from? That's whichever thread
+  // has created a pool, which is the main thread.
+  static bool onPoolThread();
+
+private:
+  // Sizes are rounded up to a multiple of ALIGN, which is also the alignment
+  // of every block. Anything larger than MAX_SIZE bypasses the pool.
+  static const size_t ALIGN = 16;
+  static const size_t MAX_SIZE = 256;
+  static const size_t SIZE_CLASSES = MAX_SIZE / ALIGN;
+  static const size_t BLOCKS_PER_SLAB = 64;
+
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  FreeBlock* freeLists[SIZE_CLASSES];
+  std::vector<void*> slabs;
+  CallbackPoolStats counts;
+  mutable Mutex mutex;
+
+  static thread_local bool poolThread;
+};
+
+
+// An allocator for std::allocate_shared() which gets memory from a
+// CallbackPool.
+template <typename T>
+class PoolAllocator {
+public:
+  typedef T value_type;
+
+  explicit PoolAllocator(const std::shared_ptr<CallbackPool>& pool) : pool(pool) {
+  }
+
+  template <typename U>
+  PoolAllocator(const PoolAllocator<U>& other) : pool(other.pool) {
+  }
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(pool->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+    pool->deallocate(p, n * sizeof(T));
+  }
+
+  template <typename U>
+  bool operator==(const PoolAllocator<U>& other) const {
+    return pool == other.pool;
+  }
+
+  template <typename U>
+  bool operator!=(const PoolAllocator<U>& other) const {
+    return pool != other.pool;
+  }
+
+  std::shared_ptr<CallbackPool> pool;
+};
+
+// Create a callback of type T in the pool, or with the system allocator if
+// this isn't the pool's thread.
+template <typename T, typename... Args>
+std::shared_ptr<T> allocate_callback(const std::shared_ptr<CallbackPool>& pool, Args&&... args) {
+  if (!CallbackPool::onPoolThread()) {
+    return std::make_shared<T>(std::forward<Args>(args)...);
+  }
+  return std::allocate_shared<T>(PoolAllocator<T>(pool), std::forward<Args>(args)...);
+}
+
+#endif // _CALLBACK_POOL_H_
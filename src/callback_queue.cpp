@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "callback_queue.h"
+
+QueueType queueTypeFromString(const std::string& name) {
+  if (name == "tree") {
+    return QUEUE_TREE;
+  } else if (name == "wheel") {
+    return QUEUE_WHEEL;
+  }
+  throw std::runtime_error("Unknown queue type: " + name);
+}
+
+std::unique_ptr<CallbackQueue> createCallbackQueue(QueueType type) {
+  switch (type) {
+  case QUEUE_WHEEL:
+    return std::unique_ptr<CallbackQueue>(new CallbackWheel());
+  case QUEUE_TREE:
+  default:
+    return std::unique_ptr<CallbackQueue>(new CallbackSet());
+  }
+}
+
+
+// ============================================================================
+// CallbackSet
+// ============================================================================
+
+void CallbackSet::insert(const Callback_sp& cb) {
+  queueIndex[cb->getCallbackId()] = queue.insert(cb).first;
+}
+
+bool CallbackSet::remove(uint64_t id) {
+  std::unordered_map<uint64_t, cbSet::iterator>::iterator it = queueIndex.find(id);
+  if (it == queueIndex.end()) {
+    return false;
+  }
+
+  queue.erase(it->second);
+  queueIndex.erase(it);
+  return true;
+}
+
+bool CallbackSet::empty() const {
+  return queue.empty();
+}
+
+Optional<Timestamp> CallbackSet::nextTimestamp() {
+  if (queue.empty()) {
+    return Optional<Timestamp>();
+  }
+  return Optional<Timestamp>((*queue.begin())->when);
+}
+
+Callback_sp CallbackSet::peek(const Timestamp& time) {
+  if (!queue.empty() && !((*queue.begin())->when > time)) {
+    return *queue.begin();
+  }
+  return Callback_sp();
+}
+
+Callback_sp CallbackSet::pop(const Timestamp& time) {
+  Callback_sp result = peek(time);
+  if (result != nullptr) {
+    queueIndex.erase(result->getCallbackId());
+    queue.erase(queue.begin());
+  }
+  return result;
+}
+
+std::vector<Callback_sp> CallbackSet::contents() const {
+  return std::vector<Callback_sp>(queue.begin(), queue.end());
+}
+
+
+// ============================================================================
+// CallbackWheel
+// ============================================================================
+
+const double CallbackWheel::TICKS_PER_SEC = 1000;
+
+CallbackWheel::CallbackWheel() : cur(0), nextValid(true) {
+  for (int level = 0; level < LEVELS; level++) {
+    std::fill(occupied[level], occupied[level] + WORDS, 0);
+  }
+}
+
+uint64_t CallbackWheel::tickOf(const Timestamp& when) const {
+  double ticks = std::floor(when.diff_secs(origin) * TICKS_PER_SEC);
+  if (ticks <= 0) {
+    return 0;
+  } else if (ticks >= 1.8e19) {
+    return UINT64_MAX;
+  }
+  return (uint64_t)ticks;
+}
+
+// Put a callback in the right place for its tick, relative to the current
+// tick, and record its location in the index.
+void CallbackWheel::place(const Callback_sp& cb, uint64_t tick) {
+  Location& loc = index[cb->getCallbackId()];
+
+  if (tick < cur) {
+    loc.level = LEVEL_READY;
+    loc.readyIt = ready.insert(cb).first;
+    return;
+  }
+
+  // The lowest level whose current rotation contains the tick.
+  for (int level = 0; level < LEVELS; level++) {
+    int shift = SLOT_BITS * (level + 1);
+    if ((tick >> shift) == (cur >> shift)) {
+      int slot = (int)((tick >> (SLOT_BITS * level)) & SLOT_MASK);
+      loc.level = level;
+      loc.slot = slot;
+      loc.it = slots[level][slot].insert(slots[level][slot].end(), cb);
+      occupied[level][slot / 64] |= (uint64_t)1 << (slot % 64);
+      return;
+    }
+  }
+
+  loc.level = LEVEL_OVERFLOW;
+  loc.it = overflow.insert(overflow.end(), cb);
+}
+
+// Returns the index of the first non-empty slot at `level`, at or after
+// `from`, or -1 if there is none.
+int CallbackWheel::nextOccupied(int level, int from) const {
+  for (int word = from / 64; word < WORDS; word++) {
+    uint64_t bits = occupied[level][word];
+    if (word == from / 64) {
+      bits &= ~(uint64_t)0 << (from % 64);
+    }
+    if (bits != 0) {
+      int bit = 0;
+      while (!(bits & ((uint64_t)1 << bit))) {
+        bit++;
+      }
+      return word * 64 + bit;
+    }
+  }
+  return -1;
+}
+
+// Moves all callbacks out of `slot` and places them again, relative to the
+// current tick.
+void CallbackWheel::moveSlot(Slot& slot) {
+  Slot pending;
+  pending.swap(slot);
+  for (Slot::iterator it = pending.begin(); it != pending.end(); ++it) {
+    place(*it, tickOf((*it)->when));
+  }
+}
+
+// When the current tick moves into a new slot at level 1 or above, the
+// callbacks in that slot need to be redistributed to lower levels. Work from
+// the top down, since cascading one level can fill the current slot of the
+// level below it.
+void CallbackWheel::cascadePending() {
+  for (int level = LEVELS - 1; level >= 1; level--) {
+    int slot = (int)((cur >> (SLOT_BITS * level)) & SLOT_MASK);
+    if (occupied[level][slot / 64] & ((uint64_t)1 << (slot % 64))) {
+      occupied[level][slot / 64] &= ~((uint64_t)1 << (slot % 64));
+      moveSlot(slots[level][slot]);
+    }
+  }
+}
+
+// Finds the earliest non-empty slot. Lower levels always come before higher
+// ones, because each level only holds callbacks in slots after the current
+// one. Assumes cascadePending() has been called. Returns false if the wheel
+// and overflow list are both empty.
+bool CallbackWheel::findNext(int& level, int& slot, uint64_t& start) const {
+  for (level = 0; level < LEVELS; level++) {
+    int shift = SLOT_BITS * level;
+    int curSlot = (int)((cur >> shift) & SLOT_MASK);
+    slot = nextOccupied(level, level == 0 ? curSlot : curSlot + 1);
+    if (slot >= 0) {
+      uint64_t rotation = cur >> (shift + SLOT_BITS) << (shift + SLOT_BITS);
+      start = rotation | ((uint64_t)slot << shift);
+      return true;
+    }
+  }
+
+  if (!overflow.empty()) {
+    // The overflow list is revisited at the start of each top-level rotation.
+    level = LEVEL_OVERFLOW;
+    slot = 0;
+    int shift = SLOT_BITS * LEVELS;
+    start = ((cur >> shift) + 1) << shift;
+    return true;
+  }
+
+  return false;
+}
+
+// Move every callback whose tick is at or before `target` into `ready`.
+void CallbackWheel::advance(uint64_t target) {
+  if (target == UINT64_MAX) {
+    target--;
+  }
+
+  while (cur <= target) {
+    cascadePending();
+
+    int level, slot;
+    uint64_t start;
+    if (!findNext(level, slot, start) || start > target) {
+      // Nothing else is due by the target tick. Every slot between here and
+      // there is empty, so it's safe to jump straight to it.
+      cur = target + 1;
+      return;
+    }
+
+    if (level == 0) {
+      Slot& s = slots[0][slot];
+      for (Slot::iterator it = s.begin(); it != s.end(); ++it) {
+        Location& loc = index[(*it)->getCallbackId()];
+        loc.level = LEVEL_READY;
+        loc.readyIt = ready.insert(*it).first;
+      }
+      s.clear();
+      occupied[0][slot / 64] &= ~((uint64_t)1 << (slot % 64));
+      cur = start + 1;
+    } else if (level == LEVEL_OVERFLOW) {
+      cur = start;
+      moveSlot(overflow);
+    } else {
+      // This slot will be cascaded at the top of the next iteration.
+      cur = start;
+    }
+  }
+}
+
+void CallbackWheel::insert(const Callback_sp& cb) {
+  place(cb, tickOf(cb->when));
+
+  if (nextValid && (!next.has_value() || cb->when < *next)) {
+    next = cb->when;
+  }
+}
+
+bool CallbackWheel::remove(uint64_t id) {
+  std::unordered_map<uint64_t, Location>::iterator it = index.find(id);
+  if (it == index.end()) {
+    return false;
+  }
+
+  Location& loc = it->second;
+  Timestamp when;
+  if (loc.level == LEVEL_READY) {
+    when = (*loc.readyIt)->when;
+    ready.erase(loc.readyIt);
+  } else if (loc.level == LEVEL_OVERFLOW) {
+    when = (*loc.it)->when;
+    overflow.erase(loc.it);
+  } else {
+    Slot& s = slots[loc.level][loc.slot];
+    when = (*loc.it)->when;
+    s.erase(loc.it);
+    if (s.empty()) {
+      occupied[loc.level][loc.slot / 64] &= ~((uint64_t)1 << (loc.slot % 64));
+    }
+  }
+  index.erase(it);
+
+  if (nextValid && next.has_value() && !(*next < when)) {
+    nextValid = false;
+  }
+  return true;
+}
+
+bool CallbackWheel::empty() const {
+  return index.empty();
+}
+
+Optional<Timestamp> CallbackWheel::nextTimestamp() {
+  if (nextValid) {
+    return next;
+  }
+
+  next.reset();
+  if (!ready.empty()) {
+    // Everything in `ready` is due before anything still in the wheel.
+    next = (*ready.begin())->when;
+  } else {
+    cascadePending();
+
+    int level, slot;
+    uint64_t start;
+    if (findNext(level, slot, start)) {
+      const Slot& s = level == LEVEL_OVERFLOW ? overflow : slots[level][slot];
+      for (Slot::const_iterator it = s.begin(); it != s.end(); ++it) {
+        if (!next.has_value() || (*it)->when < *next) {
+          next = (*it)->when;
+        }
+      }
+    }
+  }
+
+  nextValid = true;
+  return next;
+}
+
+Callback_sp CallbackWheel::peek(const Timestamp& time) {
+  advance(tickOf(time));
+
+  if (!ready.empty() && !((*ready.begin())->when > time)) {
+    return *ready.begin();
+  }
+  return Callback_sp();
+}
+
+Callback_sp CallbackWheel::pop(const Timestamp& time) {
+  Callback_sp result = peek(time);
+  if (result != nullptr) {
+    index.erase(result->getCallbackId());
+    ready.erase(ready.begin());
+    nextValid = false;
+  }
+  return result;
+}
+
+std::vector<Callback_sp> CallbackWheel::contents() const {
+  std::vector<Callback_sp> result(ready.begin(), ready.end());
+  for (int level = 0; level < LEVELS; level++) {
+    for (int slot = 0; slot < SLOTS; slot++) {
+      result.insert(result.end(), slots[level][slot].begin(), slots[level][slot].end());
+    }
+  }
+  result.insert(result.end(), overflow.begin(), overflow.end());
+
+  std::sort(result.begin(), result.end(), pointer_less_than<Callback_sp>());
+  return result;
+}
+
+
+// ============================================================================
+// CallbackFifo
+// ============================================================================
+
+bool CallbackFifo::accepts(const Callback_sp& cb) const {
+  if (entries.empty()) {
+    return true;
+  }
+  const Entry& last = entries.back();
+  return !(cb->when < last.when) && cb->getCallbackId() > last.id;
+}
+
+void CallbackFifo::push(const Callback_sp& cb) {
+  Entry entry = { cb->when, cb->getCallbackId(), cb };
+  entries.push_back(entry);
+  live++;
+}
+
+struct EntryIdLess {
+  template <typename Entry>
+  bool operator()(const Entry& entry, uint64_t id) const {
+    return entry.id < id;
+  }
+};
+
+bool CallbackFifo::remove(uint64_t id) {
+  std::deque<Entry>::iterator it =
+    std::lower_bound(entries.begin(), entries.end(), id, EntryIdLess());
+  if (it == entries.end() || it->id != id || it->callback == nullptr) {
+    return false;
+  }
+
+  it->callback.reset();
+  live--;
+  trim();
+  return true;
+}
+
+const Callback_sp& CallbackFifo::front() const {
+  return entries.front().callback;
+}
+
+void CallbackFifo::pop() {
+  entries.pop_front();
+  live--;
+  trim();
+}
+
+void CallbackFifo::trim() {
+  while (!entries.empty() && entries.front().callback == nullptr) {
+    entries.pop_front();
+  }
+}
+
+void CallbackFifo::appendTo(std::vector<Callback_sp>& out) const {
+  for (std::deque<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+    if (it->callback != nullptr) {
+      out.push_back(it->callback);
+    }
+  }
+}
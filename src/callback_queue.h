@@ -0,0 +1,222 @@
+#ifndef _CALLBACK_QUEUE_H_
+#define _CALLBACK_QUEUE_H_
+
+#include <deque>
+#include <list>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "callback_registry.h"
+
+// ============================================================================
+// CallbackQueue
+// ============================================================================
+//
+// The ordered container of callbacks held by each CallbackRegistry. Callbacks
+// are ordered by their timestamp, with ties broken by callback ID (that is,
+// order of creation).
+//
+// There are two implementations, which can be chosen per event loop when it
+// is created:
+// * CallbackSet is a balanced tree (std::set). It is the default.
+// * CallbackWheel is a hierarchical timing wheel. Inserting and cancelling
+//   callbacks is O(1), which makes it better suited to loops that hold a
+//   very large number of timers, most of which are cancelled before they
+//   fire.
+//
+// CallbackQueue objects are not thread-safe; the owning CallbackRegistry
+// serializes access with its mutex.
+
+enum QueueType {
+  QUEUE_TREE,
+  QUEUE_WHEEL
+};
+
+// Converts "tree" or "wheel" to a QueueType. Throws if the name is invalid.
+QueueType queueTypeFromString(const std::string& name);
+
+class CallbackQueue {
+public:
+  virtual ~CallbackQueue() {}
+
+  virtual void insert(const Callback_sp& cb) = 0;
+
+  // Remove the callback with the given ID. Returns true if it was present.
+  virtual bool remove(uint64_t id) = 0;
+
+  virtual bool empty() const = 0;
+
+  // The smallest timestamp in the queue, if any.
+  virtual Optional<Timestamp> nextTimestamp() = 0;
+
+  // If the first callback is due at `time`, return it, without removing it.
+  // Otherwise return an empty pointer.
+  virtual Callback_sp peek(const Timestamp& time) = 0;
+
+  // If the first callback is due at `time`, remove and return it. Otherwise
+  // return an empty pointer.
+  virtual Callback_sp pop(const Timestamp& time) = 0;
+
+  // All callbacks in the queue, in order.
+  virtual std::vector<Callback_sp> contents() const = 0;
+};
+
+std::unique_ptr<CallbackQueue> createCallbackQueue(QueueType type);
+
+
+// Balanced-tree implementation of CallbackQueue.
+class CallbackSet : public CallbackQueue {
+public:
+  void insert(const Callback_sp& cb);
+  bool remove(uint64_t id);
+  bool empty() const;
+  Optional<Timestamp> nextTimestamp();
+  Callback_sp peek(const Timestamp& time);
+  Callback_sp pop(const Timestamp& time);
+  std::vector<Callback_sp> contents() const;
+
+private:
+  // Most of the behavior of the registry is like a priority queue. However, a
+  // std::priority_queue only allows access to the top element, and when we
+  // cancel a callback or get an Rcpp::List representation, we need random
+  // access, so we'll use a std::set.
+  typedef std::set<Callback_sp, pointer_less_than<Callback_sp> > cbSet;
+  // This is a priority queue of shared pointers to Callback objects. The
+  // reason it is not a priority_queue<Callback> is because that can cause
+  // objects to be copied on the wrong thread, and even trigger an R GC event
+  // on the wrong thread. https://github.com/r-lib/later/issues/39
+  cbSet queue;
+  // Index from callback ID to its position in the queue, so that remove()
+  // doesn't need to scan the whole queue. std::set iterators remain valid
+  // until the element they point to is erased, so these stay valid across
+  // insertions and removals of other callbacks.
+  std::unordered_map<uint64_t, cbSet::iterator> queueIndex;
+};
+
+
+// Hierarchical timing wheel implementation of CallbackQueue.
+//
+// Time is divided into ticks of TICKS_PER_SEC. Each level of the wheel has
+// SLOTS slots; a slot at level L covers SLOTS^L ticks, and level L holds the
+// callbacks that are due in a later level-L slot of the current level-(L+1)
+// rotation. Callbacks that are too far in the future for the top level are
+// kept in an overflow list.
+//
+// As time advances, the callbacks in a higher-level slot are redistributed
+// ("cascaded") into the lower levels, and callbacks in level-0 slots whose
+// tick has arrived are moved into `ready`, which is ordered by timestamp and
+// callback ID. Callbacks are only ever popped from `ready`, so callbacks that
+// share a tick still run in exactly the same order as with CallbackSet.
+class CallbackWheel : public CallbackQueue {
+public:
+  CallbackWheel();
+
+  void insert(const Callback_sp& cb);
+  bool remove(uint64_t id);
+  bool empty() const;
+  Optional<Timestamp> nextTimestamp();
+  Callback_sp peek(const Timestamp& time);
+  Callback_sp pop(const Timestamp& time);
+  std::vector<Callback_sp> contents() const;
+
+private:
+  static const int LEVELS = 4;
+  static const int SLOT_BITS = 8;
+  static const int SLOTS = 1 << SLOT_BITS;
+  static const uint64_t SLOT_MASK = SLOTS - 1;
+  static const int WORDS = SLOTS / 64;
+  static const double TICKS_PER_SEC;
+
+  typedef std::list<Callback_sp> Slot;
+  typedef std::set<Callback_sp, pointer_less_than<Callback_sp> > cbSet;
+
+  // Where a callback currently lives. `level` is one of the wheel levels, or
+  // LEVEL_READY or LEVEL_OVERFLOW.
+  struct Location {
+    int level;
+    int slot;
+    Slot::iterator it;
+    cbSet::iterator readyIt;
+  };
+  static const int LEVEL_READY = -1;
+  static const int LEVEL_OVERFLOW = LEVELS;
+
+  uint64_t tickOf(const Timestamp& when) const;
+  void place(const Callback_sp& cb, uint64_t tick);
+  void cascadePending();
+  bool findNext(int& level, int& slot, uint64_t& start) const;
+  int nextOccupied(int level, int from) const;
+  void advance(uint64_t target);
+  void moveSlot(Slot& slot);
+
+  // Timestamps are converted to ticks relative to this time.
+  Timestamp origin;
+  // The current tick. Every callback due before this tick is in `ready`.
+  uint64_t cur;
+  Slot slots[LEVELS][SLOTS];
+  // Bitmap of non-empty slots at each level, for skipping over empty slots.
+  uint64_t occupied[LEVELS][WORDS];
+  Slot overflow;
+  cbSet ready;
+  std::unordered_map<uint64_t, Location> index;
+  // Cached result of nextTimestamp(), so that repeated calls don't need to
+  // search the wheel.
+  bool nextValid;
+  Optional<Timestamp> next;
+};
+
+
+// ============================================================================
+// CallbackFifo
+// ============================================================================
+//
+// A first-in, first-out queue for callbacks scheduled with no delay, which is
+// most of them (e.g. promise resolutions). Appending and popping are O(1),
+// which is cheaper than inserting into and removing from a CallbackQueue.
+//
+// Callbacks must be appended in (timestamp, callback ID) order, so that the
+// FIFO is itself sorted the same way as a CallbackQueue; accepts() checks
+// this. Callbacks created one after another on the same thread with zero
+// delay always satisfy it. Because callback IDs in the FIFO are increasing,
+// remove() can find a callback by binary search. Removed callbacks leave
+// behind an empty entry, which is skipped when it reaches the front.
+class CallbackFifo {
+public:
+  CallbackFifo() : live(0) {}
+
+  // Can `cb` be appended without breaking the order of the FIFO?
+  bool accepts(const Callback_sp& cb) const;
+  void push(const Callback_sp& cb);
+
+  // Remove the callback with the given ID. Returns true if it was present.
+  bool remove(uint64_t id);
+
+  bool empty() const {
+    return live == 0;
+  }
+
+  // The first callback. Must not be called if the FIFO is empty.
+  const Callback_sp& front() const;
+  void pop();
+
+  // Append all callbacks in the FIFO to `out`, in order.
+  void appendTo(std::vector<Callback_sp>& out) const;
+
+private:
+  struct Entry {
+    Timestamp when;
+    uint64_t id;
+    // Empty if the callback has been removed.
+    Callback_sp callback;
+  };
+
+  // Drop removed entries from the front.
+  void trim();
+
+  std::deque<Entry> entries;
+  // Number of entries that haven't been removed.
+  size_t live;
+};
+
+#endif // _CALLBACK_QUEUE_H_
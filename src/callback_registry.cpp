@@ -1,13 +1,29 @@
+#include <algorithm>
 #include <atomic>
+#include <cmath>
 #include <functional>
 #include <memory>
 #include <vector>
 
 #include "callback_registry.h"
+#include "callback_queue.h"
+#include "callback_ingress.h"
+#include "callback_pool.h"
 #include "debug.h"
 
 static std::atomic<uint64_t> nextCallbackId(1);
 
+MissedTickPolicy missedTickPolicyFromString(const std::string& name) {
+  if (name == "skip") {
+    return MISSED_SKIP;
+  } else if (name == "coalesce") {
+    return MISSED_COALESCE;
+  } else if (name == "catch_up") {
+    return MISSED_CATCH_UP;
+  }
+  Rcpp::stop("Unknown missed tick policy: %s", name);
+}
+
 // ============================================================================
 // StdFunctionCallback
 // ============================================================================
@@ -31,6 +47,30 @@ Rcpp::RObject StdFunctionCallback::rRepresentation() const {
 }
 
 
+// ============================================================================
+// CFunctionCallback
+// ============================================================================
+
+CFunctionCallback::CFunctionCallback(Timestamp when, void (*func)(void*), void* data) :
+  Callback(when),
+  func(func),
+  data(data)
+{
+  this->callbackId = nextCallbackId++;
+}
+
+Rcpp::RObject CFunctionCallback::rRepresentation() const {
+  using namespace Rcpp;
+  ASSERT_MAIN_THREAD()
+
+  return List::create(
+    _["id"]       = callbackId,
+    _["when"]     = when.diff_secs(Timestamp()),
+    _["callback"] = Rcpp::CharacterVector::create("C/C++ function")
+  );
+}
+
+
 // ============================================================================
 // RcppFunctionCallback
 // ============================================================================
@@ -61,35 +101,44 @@ Rcpp::RObject RcppFunctionCallback::rRepresentation() const {
 
 // [[Rcpp::export(rng = false)]]
 void testCallbackOrdering() {
-  std::vector<StdFunctionCallback> callbacks;
+  // Alternate between the C++ callback types, to check that ordering doesn't
+  // depend on the type.
+  std::vector<Callback_sp> callbacks;
   Timestamp ts;
   std::function<void(void)> func;
   for (size_t i = 0; i < 100; i++) {
-    callbacks.push_back(StdFunctionCallback(ts, func));
+    if (i % 2 == 0) {
+      callbacks.push_back(std::make_shared<StdFunctionCallback>(ts, func));
+    } else {
+      callbacks.push_back(std::make_shared<CFunctionCallback>(ts, nullptr, nullptr));
+    }
   }
   for (size_t i = 1; i < 100; i++) {
-    if (callbacks[i] < callbacks[i-1]) {
+    if (*callbacks[i] < *callbacks[i-1]) {
       ::Rcpp::stop("Callback ordering is broken [1]");
     }
-    if (!(callbacks[i] > callbacks[i-1])) {
+    if (!(*callbacks[i] > *callbacks[i-1])) {
       ::Rcpp::stop("Callback ordering is broken [2]");
     }
-    if (callbacks[i-1] > callbacks[i]) {
+    if (*callbacks[i-1] > *callbacks[i]) {
       ::Rcpp::stop("Callback ordering is broken [3]");
     }
-    if (!(callbacks[i-1] < callbacks[i])) {
+    if (!(*callbacks[i-1] < *callbacks[i])) {
       ::Rcpp::stop("Callback ordering is broken [4]");
     }
   }
   for (size_t i = 100; i > 1; i--) {
-    if (callbacks[i-1] < callbacks[i-2]) {
+    if (*callbacks[i-1] < *callbacks[i-2]) {
       ::Rcpp::stop("Callback ordering is broken [2]");
     }
   }
 }
 
-CallbackRegistry::CallbackRegistry(int id, Mutex* mutex, ConditionVariable* condvar)
-  : id(id), mutex(mutex), condvar(condvar)
+CallbackRegistry::CallbackRegistry(int id, Mutex* mutex, ConditionVariable* condvar, std::unique_ptr<CallbackQueue> queue)
+  : id(id), queue(std::move(queue)), immediate(new CallbackFifo()),
+    ingress(std::make_shared<CallbackIngress>()),
+    pool(std::make_shared<CallbackPool>()), mutex(mutex), condvar(condvar),
+    runNext(0), runLive(0), slack(0)
 {
   ASSERT_MAIN_THREAD()
 }
@@ -102,75 +151,323 @@ int CallbackRegistry::getId() const {
   return id;
 }
 
-uint64_t CallbackRegistry::add(const Rcpp::Function& func, double secs) {
+std::shared_ptr<CallbackIngress> CallbackRegistry::getIngress() const {
+  return ingress;
+}
+
+std::shared_ptr<CallbackPool> CallbackRegistry::getPool() const {
+  return pool;
+}
+
+static bool sameTimestamp(const Optional<Timestamp>& a, const Optional<Timestamp>& b) {
+  if (a.has_value() != b.has_value()) {
+    return false;
+  }
+  return !a.has_value() || (!(*a < *b) && !(*b < *a));
+}
+
+void CallbackRegistry::drainIngress() const {
+  ingress->resetWakeup();
+  bool changed = false;
+  if (pendingMin.has_value()) {
+    pendingMin.reset();
+    changed = true;
+  }
+  Callback_sp cb;
+  while ((cb = ingress->pop()) != nullptr) {
+    queue->insert(cb);
+    changed = true;
+  }
+  if (syncRunList()) {
+    changed = true;
+  }
+  if (changed) {
+    updateSubtreeMin();
+  }
+}
+
+bool CallbackRegistry::syncRunList() const {
+  while (runNext < runList.size() && runList[runNext] == nullptr) {
+    runNext++;
+  }
+
+  Optional<Timestamp> runMin;
+  if (runNext < runList.size()) {
+    runMin = runList[runNext]->when;
+  } else if (!runList.empty()) {
+    runList.clear();
+    runNext = 0;
+  }
+
+  if (sameTimestamp(runMin, runListMin)) {
+    return false;
+  }
+  runListMin = runMin;
+  return true;
+}
+
+Callback_sp CallbackRegistry::nextFromRunList() {
+  while (runNext < runList.size()) {
+    Callback_sp cb;
+    cb.swap(runList[runNext++]);
+    if (cb != nullptr) {
+      runLive--;
+      return cb;
+    }
+  }
+  return Callback_sp();
+}
+
+Callback_sp CallbackRegistry::popOne(const Timestamp& time) {
+  // Take the first callback from `immediate` if it's due and comes before
+  // the first due callback in `queue`, in the same (timestamp, callback ID)
+  // order that list() shows.
+  if (!immediate->empty()) {
+    Callback_sp cb = immediate->front();
+    if (!(cb->when > time)) {
+      Callback_sp first = queue->peek(time);
+      if (first == nullptr || *cb < *first) {
+        immediate->pop();
+        return cb;
+      }
+    }
+  }
+  return queue->pop(time);
+}
+
+void CallbackRegistry::insert(const Callback_sp& cb, double secs) {
+  if (secs <= 0 && immediate->accepts(cb)) {
+    immediate->push(cb);
+  } else {
+    queue->insert(cb);
+  }
+}
+
+Optional<Timestamp> CallbackRegistry::nextTimestampOne() const {
+  Optional<Timestamp> next = queue->nextTimestamp();
+  if (!immediate->empty()) {
+    const Timestamp& when = immediate->front()->when;
+    if (!next.has_value() || when < *next) {
+      next = when;
+    }
+  }
+  if (runListMin.has_value() && (!next.has_value() || *runListMin < *next)) {
+    next = runListMin;
+  }
+  return next;
+}
+
+// The earlier of two optional timestamps.
+static Optional<Timestamp> earlier(const Optional<Timestamp>& a, const Optional<Timestamp>& b) {
+  if (!a.has_value() || (b.has_value() && *b < *a)) {
+    return b;
+  }
+  return a;
+}
+
+// Replace one copy of `oldValue` in `set` with `newValue`.
+static void replaceIn(std::multiset<Timestamp>& set, const Optional<Timestamp>& oldValue, const Optional<Timestamp>& newValue) {
+  if (oldValue.has_value()) {
+    std::multiset<Timestamp>::iterator it = set.find(*oldValue);
+    if (it != set.end()) {
+      set.erase(it);
+    }
+  }
+  if (newValue.has_value()) {
+    set.insert(*newValue);
+  }
+}
+
+const CallbackRegistry* CallbackRegistry::updateSubtreeMin() const {
+  Optional<Timestamp> ownMin = earlier(nextTimestampOne(), pendingMin);
+  Optional<Timestamp> newMin = ownMin;
+  Optional<Timestamp> newWake;
+  if (ownMin.has_value()) {
+    newWake = wakeTime(*ownMin);
+  }
+  if (!childMins.empty()) {
+    newMin = earlier(newMin, *childMins.begin());
+    newWake = earlier(newWake, *childWakes.begin());
+  }
+
+  if (sameTimestamp(newMin, subtreeMin) && sameTimestamp(newWake, subtreeWake)) {
+    return nullptr;
+  }
+  Optional<Timestamp> oldMin = subtreeMin;
+  Optional<Timestamp> oldWake = subtreeWake;
+  subtreeMin = newMin;
+  subtreeWake = newWake;
+  if (parent != nullptr) {
+    return parent->childMinChanged(oldMin, newMin, oldWake, newWake);
+  }
+  if (newWake.has_value() && (!oldWake.has_value() || *newWake < *oldWake)) {
+    return this;
+  }
+  return nullptr;
+}
+
+const CallbackRegistry* CallbackRegistry::childMinChanged(const Optional<Timestamp>& oldMin, const Optional<Timestamp>& newMin,
+                                                          const Optional<Timestamp>& oldWake, const Optional<Timestamp>& newWake) const {
+  replaceIn(childMins, oldMin, newMin);
+  replaceIn(childWakes, oldWake, newWake);
+  return updateSubtreeMin();
+}
+
+void CallbackRegistry::reportWake(const CallbackRegistry* root, WakeChange* change) {
+  if (root == nullptr || change == nullptr) {
+    return;
+  }
+  change->rootId = root->id;
+  change->wake = root->subtreeWake;
+}
+
+uint64_t CallbackRegistry::add(const Rcpp::Function& func, double secs, WakeChange* change) {
   // Copies of the Rcpp::Function should only be made on the main thread.
   ASSERT_MAIN_THREAD()
   Timestamp when(secs);
-  Callback_sp cb = std::make_shared<RcppFunctionCallback>(when, func);
+  Callback_sp cb = allocate_callback<RcppFunctionCallback>(pool, when, func);
   Guard guard(mutex);
-  queue.insert(cb);
+  insert(cb, secs);
+  reportWake(updateSubtreeMin(), change);
   condvar->signal();
 
   return cb->getCallbackId();
 }
 
-uint64_t CallbackRegistry::add(void (*func)(void*), void* data, double secs) {
-  Timestamp when(secs);
-  Callback_sp cb = std::make_shared<StdFunctionCallback>(when, std::bind(func, data));
+std::vector<uint64_t> CallbackRegistry::add(const Rcpp::List& funcs, const Rcpp::NumericVector& secs,
+                                            WakeChange* change) {
+  ASSERT_MAIN_THREAD()
+  std::vector<Callback_sp> callbacks;
+  callbacks.reserve(funcs.size());
+  for (R_xlen_t i = 0; i < funcs.size(); i++) {
+    Timestamp when(secs[i]);
+    callbacks.push_back(allocate_callback<RcppFunctionCallback>(pool, when, Rcpp::Function(funcs[i])));
+  }
+
+  std::vector<uint64_t> ids;
+  ids.reserve(callbacks.size());
+  Guard guard(mutex);
+  for (size_t i = 0; i < callbacks.size(); i++) {
+    insert(callbacks[i], secs[i]);
+    ids.push_back(callbacks[i]->getCallbackId());
+  }
+  reportWake(updateSubtreeMin(), change);
+  condvar->signal();
+
+  return ids;
+}
+
+uint64_t CallbackRegistry::addRepeating(const Callback_sp& cb, double delaySecs, WakeChange* change) {
   Guard guard(mutex);
-  queue.insert(cb);
+  repeating[cb->getCallbackId()] = cb;
+  insert(cb, delaySecs);
+  reportWake(updateSubtreeMin(), change);
   condvar->signal();
 
   return cb->getCallbackId();
 }
 
-bool CallbackRegistry::cancel(uint64_t id) {
+Optional<Timestamp> CallbackRegistry::reschedule(const Callback_sp& cb, WakeChange* change) {
+  if (cb->interval <= 0) {
+    return Optional<Timestamp>();
+  }
   Guard guard(mutex);
+  if (repeating.find(cb->getCallbackId()) == repeating.end()) {
+    return Optional<Timestamp>();
+  }
 
-  cbSet::const_iterator it;
-  for (it = queue.begin(); it != queue.end(); ++it) {
-    if ((*it)->getCallbackId() == id) {
-      queue.erase(it);
-      return true;
+  Timestamp now;
+  Timestamp next = cb->when.plus_secs(cb->interval);
+  if (!(next > now) && cb->missed != MISSED_CATCH_UP) {
+    // Number of deadlines that have passed since the one that just ran.
+    double passed = std::floor(now.diff_secs(cb->when) / cb->interval);
+    if (cb->missed == MISSED_SKIP) {
+      next = cb->when.plus_secs((passed + 1) * cb->interval);
+      if (!(next > now)) {
+        next = next.plus_secs(cb->interval);
+      }
+    } else {
+      next = cb->when.plus_secs(passed * cb->interval);
     }
   }
 
-  return false;
+  cb->when = next;
+  queue->insert(cb);
+  reportWake(updateSubtreeMin(), change);
+  condvar->signal();
+  return next;
+}
+
+bool CallbackRegistry::cancel(uint64_t id) {
+  Guard guard(mutex);
+  drainIngress();
+  // A repeating callback might not be in any of the containers, if it's
+  // running right now. Removing it from `repeating` stops it from being
+  // rescheduled.
+  bool wasRepeating = !repeating.empty() && repeating.erase(id) > 0;
+  if (immediate->remove(id) || queue->remove(id)) {
+    updateSubtreeMin();
+    return true;
+  }
+
+  // The callback may be in runList, waiting to be handed out by pop().
+  if (runLive == 0) {
+    return wasRepeating;
+  }
+  if (runIndex.empty()) {
+    for (size_t i = runNext; i < runList.size(); i++) {
+      if (runList[i] != nullptr) {
+        runIndex[runList[i]->getCallbackId()] = i;
+      }
+    }
+  }
+  std::unordered_map<uint64_t, size_t>::iterator it = runIndex.find(id);
+  if (it == runIndex.end() || runList[it->second] == nullptr) {
+    return wasRepeating;
+  }
+  runList[it->second].reset();
+  runIndex.erase(it);
+  runLive--;
+  if (syncRunList()) {
+    updateSubtreeMin();
+  }
+  return true;
 }
 
 // The smallest timestamp present in the registry, if any.
 // Use this to determine the next time we need to pump events.
 Optional<Timestamp> CallbackRegistry::nextTimestamp(bool recursive) const {
   Guard guard(mutex);
+  drainIngress();
 
-  Optional<Timestamp> minTimestamp;
-
-  if (! this->queue.empty()) {
-    cbSet::const_iterator it = queue.begin();
-    minTimestamp = Optional<Timestamp>((*it)->when);
-  }
-
-  // Now check children
   if (recursive) {
-    for (std::vector<std::shared_ptr<CallbackRegistry> >::const_iterator it = children.begin();
-         it != children.end();
-         ++it)
-    {
-      Optional<Timestamp> childNextTimestamp = (*it)->nextTimestamp(recursive);
-
-      if (childNextTimestamp.has_value()) {
-        if (minTimestamp.has_value()) {
-          if (*childNextTimestamp < *minTimestamp) {
-            minTimestamp = childNextTimestamp;
-          }
-        } else {
-          minTimestamp = childNextTimestamp;
-        }
-      }
-    }
+    return subtreeMin;
   }
+  return nextTimestampOne();
+}
+
+Optional<Timestamp> CallbackRegistry::nextWakeTime() const {
+  Guard guard(mutex);
+  drainIngress();
+  return subtreeWake;
+}
+
+void CallbackRegistry::setSlack(double secs) {
+  Guard guard(mutex);
+  slack = secs;
+  updateSubtreeMin();
+}
 
-  return minTimestamp;
+double CallbackRegistry::getSlack() const {
+  Guard guard(mutex);
+  return slack;
+}
+
+Timestamp CallbackRegistry::wakeTime(const Timestamp& when) const {
+  if (slack > 0) {
+    return when.plus_secs(slack);
+  }
+  return when;
 }
 
 bool CallbackRegistry::empty() const {
@@ -178,43 +475,49 @@ bool CallbackRegistry::empty() const {
     return false;
   }
   Guard guard(mutex);
-  return this->queue.empty();
+  drainIngress();
+  return this->immediate->empty() && this->queue->empty() && runLive == 0;
+}
+
+bool CallbackRegistry::hasImmediate() const {
+  Guard guard(mutex);
+  return !immediate->empty();
 }
 
 // Returns true if the smallest timestamp exists and is not in the future.
 bool CallbackRegistry::due(const Timestamp& time, bool recursive) const {
   ASSERT_MAIN_THREAD()
   Guard guard(mutex);
-  cbSet::const_iterator cbSet_it = queue.begin();
-  if (!this->queue.empty() && !((*cbSet_it)->when > time)) {
-    return true;
-  }
-
-  // Now check children
-  if (recursive) {
-    for (std::vector<std::shared_ptr<CallbackRegistry> >::const_iterator it = children.begin();
-         it != children.end();
-         ++it)
-    {
-      if ((*it)->due(time, true)) {
-        return true;
-      }
-    }
-  }
-
-  return false;
+  drainIngress();
+  Optional<Timestamp> next = recursive ? subtreeMin : nextTimestampOne();
+  return next.has_value() && !(*next > time);
 }
 
 Callback_sp CallbackRegistry::pop(const Timestamp& time) {
   ASSERT_MAIN_THREAD()
+  // If there's anything left from the last batch, it's handed out without
+  // taking the mutex.
+  Callback_sp cb = nextFromRunList();
+  if (cb != nullptr) {
+    return cb;
+  }
+
   Guard guard(mutex);
-  Callback_sp result;
-  if (this->due(time, false)) {
-    cbSet::iterator it = queue.begin();
-    result = *it;
-    this->queue.erase(it);
+  drainIngress();
+
+  // Move every callback that's due into runList, in order.
+  runIndex.clear();
+  while ((cb = popOne(time)) != nullptr) {
+    runList.push_back(cb);
   }
-  return result;
+  runLive = runList.size();
+  if (runList.empty()) {
+    return Callback_sp();
+  }
+
+  syncRunList();
+  updateSubtreeMin();
+  return nextFromRunList();
 }
 
 bool CallbackRegistry::wait(double timeoutSecs, bool recursive) const {
@@ -252,18 +555,68 @@ bool CallbackRegistry::wait(double timeoutSecs, bool recursive) const {
 Rcpp::List CallbackRegistry::list() const {
   ASSERT_MAIN_THREAD()
   Guard guard(mutex);
+  drainIngress();
 
   Rcpp::List results;
 
-  cbSet::const_iterator it;
+  // Each of the containers is already in order, so they just need to be
+  // merged.
+  std::vector<Callback_sp> callbacks;
+  for (size_t i = runNext; i < runList.size(); i++) {
+    if (runList[i] != nullptr) {
+      callbacks.push_back(runList[i]);
+    }
+  }
+  size_t n_run = callbacks.size();
+  std::vector<Callback_sp> queued = queue->contents();
+  callbacks.insert(callbacks.end(), queued.begin(), queued.end());
+  std::inplace_merge(
+    callbacks.begin(), callbacks.begin() + n_run, callbacks.end(),
+    pointer_less_than<Callback_sp>()
+  );
+  size_t n_queue = callbacks.size();
+  immediate->appendTo(callbacks);
+  std::inplace_merge(
+    callbacks.begin(), callbacks.begin() + n_queue, callbacks.end(),
+    pointer_less_than<Callback_sp>()
+  );
+  std::vector<Callback_sp>::const_iterator it;
 
-  for (it = queue.begin(); it != queue.end(); it++) {
+  for (it = callbacks.begin(); it != callbacks.end(); it++) {
     results.push_back((*it)->rRepresentation());
   }
 
   return results;
 }
 
+void CallbackRegistry::notePending(const Timestamp& when, WakeChange* change) {
+  if (!pendingMin.has_value() || when < *pendingMin) {
+    pendingMin = when;
+    reportWake(updateSubtreeMin(), change);
+  }
+}
+
+void CallbackRegistry::addChild(const std::shared_ptr<CallbackRegistry>& child) {
+  child->parent = shared_from_this();
+  children.push_back(child);
+  if (child->subtreeMin.has_value()) {
+    childMinChanged(Optional<Timestamp>(), child->subtreeMin, Optional<Timestamp>(), child->subtreeWake);
+  }
+}
+
+void CallbackRegistry::removeChild(const std::shared_ptr<CallbackRegistry>& child) {
+  std::vector<std::shared_ptr<CallbackRegistry> >::iterator it =
+    std::find(children.begin(), children.end(), child);
+  if (it == children.end()) {
+    return;
+  }
+  children.erase(it);
+  child->parent.reset();
+  if (child->subtreeMin.has_value()) {
+    childMinChanged(child->subtreeMin, Optional<Timestamp>(), child->subtreeWake, Optional<Timestamp>());
+  }
+}
+
 void CallbackRegistry::fd_waits_incr() {
   ++fd_waits;
 }
@@ -5,13 +5,33 @@
 #include <atomic>
 #include <functional>
 #include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "timestamp.h"
 #include "optional.h"
 #include "threadutils.h"
 
-// Callback is an abstract class with two subclasses. The reason that there
-// are two subclasses is because one of them is for C++ (std::function)
-// callbacks, and the other is for R (Rcpp::Function) callbacks. Because
+// What a repeating callback does when it falls behind schedule, so that one or
+// more of its deadlines have already passed by the time it finishes running.
+enum MissedTickPolicy {
+  // Drop the missed deadlines, and run at the next deadline in the future.
+  MISSED_SKIP,
+  // Run once more right away for all of the missed deadlines, and then carry
+  // on with the deadlines in the future.
+  MISSED_COALESCE,
+  // Run once for every missed deadline, as soon as possible.
+  MISSED_CATCH_UP
+};
+
+// Converts "skip", "coalesce" or "catch_up" to a MissedTickPolicy. Throws if
+// the name is invalid.
+MissedTickPolicy missedTickPolicyFromString(const std::string& name);
+
+// Callback is an abstract class with three subclasses: one for plain C
+// function pointers (the common case, used by the C API), one for C++
+// callables (std::function), and one for R (Rcpp::Function) callbacks. Because
 // Callbacks can be created from either the main thread or a background
 // thread, the top-level Callback class cannot contain any Rcpp objects --
 // otherwise R objects could be allocated on a background thread, which will
@@ -21,7 +41,7 @@ class Callback {
 
 public:
   virtual ~Callback() {};
-  Callback(Timestamp when) : when(when) {};
+  Callback(Timestamp when) : when(when), interval(0), missed(MISSED_SKIP) {};
 
   bool operator<(const Callback& other) const {
     return this->when < other.when ||
@@ -42,6 +62,12 @@ public:
 
   Timestamp when;
 
+  // For repeating callbacks, the number of seconds between deadlines, and
+  // what to do about missed deadlines. `interval` is 0 for callbacks that run
+  // only once. See CallbackRegistry::addRepeating().
+  double interval;
+  MissedTickPolicy missed;
+
 protected:
   // Used to break ties when comparing to a callback that has precisely the same
   // timestamp
@@ -69,6 +95,30 @@ private:
 };
 
 
+// A callback for a C function and its data pointer, as passed to the C API.
+// These are stored directly, so unlike StdFunctionCallback, no type erasure or
+// extra allocation is needed.
+class CFunctionCallback : public Callback {
+public:
+  CFunctionCallback(Timestamp when, void (*func)(void*), void* data);
+
+  void invoke() const {
+    // See https://github.com/r-lib/later/issues/191 and https://github.com/r-lib/later/pull/241
+    Rcpp::unwindProtect([this]() {
+      BEGIN_RCPP
+      func(data);
+      END_RCPP
+    });
+  }
+
+  Rcpp::RObject rRepresentation() const;
+
+private:
+  void (*func)(void*);
+  void* data;
+};
+
+
 class RcppFunctionCallback : public Callback {
 public:
   RcppFunctionCallback(Timestamp when, const Rcpp::Function& func);
@@ -89,62 +139,225 @@ typedef std::shared_ptr<Callback> Callback_sp;
 
 template <typename T>
 struct pointer_less_than {
-  const bool operator()(const T a, const T b) const {
+  bool operator()(const T& a, const T& b) const {
     return *a < *b;
   }
 };
 
 
+class CallbackQueue;
+class CallbackFifo;
+class CallbackIngress;
+class CallbackPool;
+
+// How adding callbacks to a registry changed the time at which the loop at the
+// top of its tree needs to be woken up (see CallbackRegistry::nextWakeTime()).
+// Most adds land behind the earliest callback and don't change it, and then
+// whatever wakes the loop doesn't need to be touched.
+struct WakeChange {
+  WakeChange() : rootId(-1) {}
+
+  // The ID of the loop at the top of the tree, if the wake time moved.
+  int rootId;
+  // The new wake time, if it moved earlier.
+  Optional<Timestamp> wake;
+};
+
 // Stores R function callbacks, ordered by timestamp.
-class CallbackRegistry {
+class CallbackRegistry : public std::enable_shared_from_this<CallbackRegistry> {
 private:
   int id;
 
-  // Most of the behavior of the registry is like a priority queue. However, a
-  // std::priority_queue only allows access to the top element, and when we
-  // cancel a callback or get an Rcpp::List representation, we need random
-  // access, so we'll use a std::set.
-  typedef std::set<Callback_sp, pointer_less_than<Callback_sp> > cbSet;
-  // This is a priority queue of shared pointers to Callback objects. The
-  // reason it is not a priority_queue<Callback> is because that can cause
-  // objects to be copied on the wrong thread, and even trigger an R GC event
-  // on the wrong thread. https://github.com/r-lib/later/issues/39
-  cbSet queue;
+  // The callbacks, ordered by timestamp. The container used depends on the
+  // queue type chosen when the loop was created; see callback_queue.h.
+  std::unique_ptr<CallbackQueue> queue;
+  // Callbacks scheduled on the main thread with no delay. These are kept in
+  // a FIFO, which is cheaper than `queue`; pop() takes from whichever of the
+  // two has the earliest callback. See CallbackFifo in callback_queue.h.
+  std::unique_ptr<CallbackFifo> immediate;
+  // Callbacks scheduled from other threads, which haven't been moved into
+  // `queue` yet. See callback_ingress.h.
+  std::shared_ptr<CallbackIngress> ingress;
+  // Memory for this registry's callbacks. See callback_pool.h.
+  std::shared_ptr<CallbackPool> pool;
   std::atomic<int> fd_waits{};
   Mutex* mutex;
   ConditionVariable* condvar;
 
+  // Callbacks that were due the last time pop() looked, in order. pop() moves
+  // all of them out of `queue` and `immediate` in one step, and then hands
+  // them out one at a time without taking the mutex. Until they are handed
+  // out, they are still part of the registry: they can be cancelled, and are
+  // counted by empty() and list(). If a callback throws an error, the rest
+  // stay here and run the next time the loop runs.
+  //
+  // These are only accessed from the main thread. Cancelled callbacks leave
+  // an empty pointer behind.
+  mutable std::vector<Callback_sp> runList;
+  // Index of the next callback in runList to hand out.
+  mutable size_t runNext;
+  // Number of callbacks in runList that haven't been handed out or cancelled.
+  mutable size_t runLive;
+  // Maps callback IDs to positions in runList, for cancel(). It's built the
+  // first time it's needed for each batch.
+  std::unordered_map<uint64_t, size_t> runIndex;
+  // The timestamp of the first callback left in runList. Unlike runList, this
+  // is protected by the mutex, so that it can be used by updateSubtreeMin()
+  // from any thread. It's only updated when the mutex is taken, so it can be
+  // earlier than the true value, but never later.
+  mutable Optional<Timestamp> runListMin;
+
+  // Repeating callbacks that haven't been cancelled, by callback ID. A
+  // repeating callback is in here both while it's scheduled and while it's
+  // running, so that it can be cancelled from inside its own function.
+  std::unordered_map<uint64_t, Callback_sp> repeating;
+
+  // The earliest timestamp in this registry and all of its descendants. It is
+  // kept up to date as callbacks are added and removed and as children are
+  // attached and detached, so that the recursive versions of nextTimestamp()
+  // and due() don't need to visit every loop in the tree.
+  //
+  // This includes callbacks from other threads that are still in a child's
+  // ingress queue (see notePending()). It can be earlier than the true value,
+  // but never later, if such a callback is drained before it's noted; the
+  // next drain of that registry corrects it.
+  mutable Optional<Timestamp> subtreeMin;
+  // The subtreeMin of each child that has one.
+  mutable std::multiset<Timestamp> childMins;
+  // Like subtreeMin, but with each registry's slack added to its own
+  // timestamps: the latest time that the loop can be woken up without making
+  // any callback in the subtree later than its slack allows. Kept up to date
+  // along with subtreeMin.
+  mutable Optional<Timestamp> subtreeWake;
+  mutable std::multiset<Timestamp> childWakes;
+
+  // How late this registry's callbacks may run, in seconds, so that a group
+  // of callbacks with nearby deadlines can be run with a single wakeup. Set
+  // with setSlack().
+  double slack;
+  // The earliest callback pushed onto `ingress` but not yet drained, if it
+  // has been reported with notePending().
+  mutable Optional<Timestamp> pendingMin;
+
+  // Move everything from `ingress` into `queue`, and sync runList. Must be
+  // called on the main thread with the mutex held.
+  void drainIngress() const;
+
+  // Bring runListMin up to date with runList, and free runList once it's all
+  // been handed out. Returns true if runListMin changed. Must be called on the
+  // main thread with the mutex held.
+  bool syncRunList() const;
+
+  // Remove and return the next callback from runList, skipping cancelled
+  // ones. Returns an empty pointer if there are none left. Main thread only;
+  // doesn't need the mutex.
+  Callback_sp nextFromRunList();
+
+  // Remove and return the first callback in `queue` or `immediate`, if it's
+  // due at `time`. Must be called with the mutex held.
+  Callback_sp popOne(const Timestamp& time);
+
+  // Add a callback to `immediate` if it has no delay and can go there, and to
+  // `queue` otherwise. Must be called with the mutex held.
+  void insert(const Callback_sp& cb, double secs);
+
+  // The earliest timestamp in this registry, not including children. Must be
+  // called with the mutex held.
+  Optional<Timestamp> nextTimestampOne() const;
+
+  // Recompute subtreeMin, and pass any change on to the parent. Must be
+  // called with the mutex held, whenever this registry's own contents change.
+  // If this moved the wake time of the registry at the top of the tree
+  // earlier, returns that registry; otherwise returns nullptr.
+  const CallbackRegistry* updateSubtreeMin() const;
+
+  // Called by a child when its subtreeMin or subtreeWake changes. Must be
+  // called with the mutex held. Returns the same as updateSubtreeMin().
+  const CallbackRegistry* childMinChanged(const Optional<Timestamp>& oldMin, const Optional<Timestamp>& newMin,
+                                          const Optional<Timestamp>& oldWake, const Optional<Timestamp>& newWake) const;
+
+  // Fill in `change` from the result of updateSubtreeMin(), if it's not null.
+  static void reportWake(const CallbackRegistry* root, WakeChange* change);
+
 public:
   // The CallbackRegistry must be given a Mutex and ConditionVariable when
   // initialized, because they are shared among the CallbackRegistry objects
   // and the CallbackRegistryTable; they serve as a global lock. Note that the
   // lifetime of these objects must be longer than the CallbackRegistry.
-  CallbackRegistry(int id, Mutex* mutex, ConditionVariable* condvar);
+  CallbackRegistry(int id, Mutex* mutex, ConditionVariable* condvar, std::unique_ptr<CallbackQueue> queue);
   ~CallbackRegistry();
 
   int getId() const;
 
-  // Add a function to the registry, to be executed at `secs` seconds in
-  // the future (i.e. relative to the current time).
-  uint64_t add(const Rcpp::Function& func, double secs);
+  // The queue that other threads use to schedule callbacks on this registry
+  // without taking the mutex. The ingress can outlive the registry.
+  std::shared_ptr<CallbackIngress> getIngress() const;
 
-  // Add a C function to the registry, to be executed at `secs` seconds in
-  // the future (i.e. relative to the current time).
-  uint64_t add(void (*func)(void*), void* data, double secs);
+  // The pool that callbacks for this registry should be allocated from. Can
+  // be used from any thread.
+  std::shared_ptr<CallbackPool> getPool() const;
 
+  // Add a function to the registry, to be executed at `secs` seconds in
+  // the future (i.e. relative to the current time). If `change` is given, it
+  // records whether this moved the wake time of the tree earlier.
+  uint64_t add(const Rcpp::Function& func, double secs, WakeChange* change = nullptr);
+
+  // Add several R functions to the registry at once. `secs` must be the same
+  // length as `funcs`. Returns the callback IDs, in the same order.
+  std::vector<uint64_t> add(const Rcpp::List& funcs, const Rcpp::NumericVector& secs,
+                            WakeChange* change = nullptr);
+
+  // Add a callback that runs repeatedly, first after `delaySecs` seconds and
+  // then every `cb->interval` seconds. Deadlines are computed from the
+  // previous deadline rather than from when the callback finished, so they
+  // don't drift. The same callback object and ID are used for every run.
+  // Returns the callback ID. `change` is as for add().
+  uint64_t addRepeating(const Callback_sp& cb, double delaySecs, WakeChange* change = nullptr);
+
+  // Put a repeating callback back in the registry after it has run, with its
+  // next deadline. Returns the new deadline, or nothing if the callback isn't
+  // repeating or has been cancelled. `change` is as for add().
+  Optional<Timestamp> reschedule(const Callback_sp& cb, WakeChange* change = nullptr);
+
+  // Remove a callback from the registry. Returns true if the callback was
+  // present, false if it has already executed or been cancelled. A repeating
+  // callback can be cancelled at any time, even while it's running.
   bool cancel(uint64_t id);
 
   // The smallest timestamp present in the registry, if any.
   // Use this to determine the next time we need to pump events.
   Optional<Timestamp> nextTimestamp(bool recursive = true) const;
 
+  // When the loop needs to be woken up to run this registry and its children:
+  // the earliest deadline, allowing for each registry's slack. If nothing has
+  // slack, this is the same as nextTimestamp().
+  Optional<Timestamp> nextWakeTime() const;
+
+  // Set and get the slack, in seconds. Callbacks are never run early, but the
+  // event loop may wait up to this long after a callback's deadline before
+  // waking up to run it, so that callbacks that are due soon after can be
+  // run at the same time.
+  void setSlack(double secs);
+  double getSlack() const;
+
+  // The time to wake up for a callback in this registry that's due at `when`.
+  // Must be called with the mutex held, since the slack can change.
+  Timestamp wakeTime(const Timestamp& when) const;
+
   // Is the registry completely empty? (including later_fd waits)
   bool empty() const;
 
+  // Are there any callbacks waiting in the zero-delay FIFO?
+  bool hasImmediate() const;
+
   // Is anything ready to execute?
   bool due(const Timestamp& time = Timestamp(), bool recursive = true) const;
 
-  // Pop and return a function to execute now.
+  // Pop and return a function to execute now. All of the callbacks that are
+  // due are taken from the queue at once, and subsequent calls return the
+  // rest of them without taking the mutex, until they run out. Callbacks
+  // added in the meantime are only considered after that, even if they're
+  // due earlier.
   Callback_sp pop(const Timestamp& time = Timestamp());
 
   // Wait until the next available callback is ready to execute.
@@ -153,13 +366,26 @@ public:
   // Return a List of items in the queue.
   Rcpp::List list() const;
 
+  // Record that a callback due at `when` has been pushed onto this registry's
+  // ingress queue, so that it's accounted for in nextTimestamp() and due() of
+  // this registry and its ancestors before it's drained. Can be called from
+  // any thread, but must be called with the mutex held. `change` is as for
+  // add().
+  void notePending(const Timestamp& when, WakeChange* change = nullptr);
+
+  // Attach and detach a child registry. These set and clear the child's
+  // `parent`, and must be called with the mutex held.
+  void addChild(const std::shared_ptr<CallbackRegistry>& child);
+  void removeChild(const std::shared_ptr<CallbackRegistry>& child);
+
   // Increment and decrement the number of active later_fd waits
   void fd_waits_incr();
   void fd_waits_decr();
 
   // References to parent and children registries. These are used for
-  // automatically running child loops. They should only be accessed and
-  // modified from the main thread.
+  // automatically running child loops. They should only be accessed from the
+  // main thread or with the mutex held, and only modified with addChild() and
+  // removeChild().
   std::shared_ptr<CallbackRegistry> parent;
   std::vector<std::shared_ptr<CallbackRegistry> > children;
 };
@@ -2,10 +2,15 @@
 #define _CALLBACK_REGISTRY_TABLE_H_
 
 #include <Rcpp.h>
+#include <atomic>
+#include <map>
 #include <memory>
 #include "threadutils.h"
 #include "debug.h"
 #include "callback_registry.h"
+#include "callback_queue.h"
+#include "callback_ingress.h"
+#include "callback_pool.h"
 #include "later.h"
 
 using std::shared_ptr;
@@ -26,6 +31,13 @@ extern CallbackRegistryTable callbackRegistryTable;
 // The operations on this class are thread-safe, because they might be used to
 // from another thread.
 //
+// scheduleCallback(), which is how background threads add callbacks, doesn't
+// take the global lock at all. It finds the target loop's CallbackIngress and
+// CallbackPool in an immutable snapshot of the table, which is replaced (on
+// the main thread) whenever a loop is created or removed, and pushes the
+// callback onto the ingress. If the loop is removed in the meantime, its
+// ingress is closed, and the callback is reported as not scheduled.
+//
 class CallbackRegistryTable {
 
   // Basically a struct that keeps track of a registry and whether or an R loop
@@ -44,7 +56,9 @@ class CallbackRegistryTable {
   };
 
 public:
-  CallbackRegistryTable() : mutex(tct_mtx_plain | tct_mtx_recursive), condvar(mutex)  {
+  CallbackRegistryTable() : mutex(tct_mtx_plain | tct_mtx_recursive), condvar(mutex),
+    ingresses(std::make_shared<IngressMap>())
+  {
   }
 
   bool exists(int id) {
@@ -53,7 +67,7 @@ public:
   }
 
   // Create a new CallbackRegistry. If parent_id is -1, then there is no parent.
-  void create(int id, int parent_id) {
+  void create(int id, int parent_id, QueueType queue_type = QUEUE_TREE) {
     ASSERT_MAIN_THREAD()
     Guard guard(&mutex);
 
@@ -68,20 +82,25 @@ public:
     // CallbackRegistry tree, and some recursively acquire a lock upward;
     // without a shared lock, if these things happen at the same time from
     // different threads, it could deadlock.
-    shared_ptr<CallbackRegistry> registry = make_shared<CallbackRegistry>(id, &mutex, &condvar);
+    shared_ptr<CallbackRegistry> registry = make_shared<CallbackRegistry>(
+      id, &mutex, &condvar, createCallbackQueue(queue_type)
+    );
 
     if (parent_id != -1) {
       shared_ptr<CallbackRegistry> parent = getRegistry(parent_id);
       if (parent == nullptr) {
         Rcpp::stop("Can't create registry. Parent with id %d does not exist.", parent_id);
       }
-      registry->parent = parent;
-      parent->children.push_back(registry);
+      parent->addChild(registry);
     }
 
     // Would be better to use .emplace() to avoid copy-constructor, but that
     // requires C++11.
     registries[id] = RegistryHandle(registry, true);
+
+    std::shared_ptr<IngressMap> newIngresses = make_shared<IngressMap>(*std::atomic_load(&ingresses));
+    (*newIngresses)[id] = IngressEntry(registry->getIngress(), registry->getPool());
+    std::atomic_store(&ingresses, std::shared_ptr<const IngressMap>(newIngresses));
   }
 
   // Returns a shared_ptr to the registry. If the registry is not present in
@@ -97,15 +116,135 @@ public:
     return registries[id].registry;
   }
 
+  // Schedule a C function on a loop. Returns the callback ID, or 0 if the
+  // loop doesn't exist.
   uint64_t scheduleCallback(void (*func)(void*), void* data, double delaySecs, int loop_id) {
-    // This method can be called from any thread
-    Guard guard(&mutex);
+    // This method can be called from any thread. The callback is put on the
+    // loop's ingress queue, and the registry moves it to its ordered queue
+    // the next time it's used. The global lock is only needed when the loop
+    // has to be woken up, which is at most once per callback that's due
+    // earlier than everything else pushed since the loop last looked.
+    std::shared_ptr<const IngressMap> snapshot = std::atomic_load(&ingresses);
+    IngressMap::const_iterator it = snapshot->find(loop_id);
+    if (it == snapshot->end()) {
+      return 0;
+    }
 
-    shared_ptr<CallbackRegistry> registry = getRegistry(loop_id);
-    if (registry == nullptr) {
+    const IngressEntry& entry = it->second;
+    Callback_sp cb = allocate_callback<CFunctionCallback>(
+      entry.pool, Timestamp(delaySecs), func, data
+    );
+    bool wake = entry.ingress->push(cb);
+    // The loop may have been removed since the snapshot was taken. If so,
+    // the callback will never run, so report it as not scheduled, as if the
+    // loop hadn't existed. It's freed along with the ingress. If the loop is
+    // removed after this check, the callback is dropped along with the rest
+    // of the loop's callbacks.
+    if (entry.ingress->closed()) {
+      return 0;
+    }
+    if (wake) {
+      wakeLoop(loop_id, cb->when);
+    }
+    return cb->getCallbackId();
+  }
+
+  // Schedule several C functions on a loop at once. The callbacks are added
+  // to the loop's ingress queue together, and the loop is woken up at most
+  // once. If `ids` is not NULL, the callback IDs are written to it. Returns
+  // the number of callbacks scheduled, which is 0 if the loop doesn't exist.
+  int scheduleCallbacks(const later_batch_item* items, int n, uint64_t* ids, int loop_id) {
+    // This method can be called from any thread.
+    std::shared_ptr<const IngressMap> snapshot = std::atomic_load(&ingresses);
+    IngressMap::const_iterator it = snapshot->find(loop_id);
+    if (it == snapshot->end() || n <= 0) {
+      return 0;
+    }
+
+    const IngressEntry& entry = it->second;
+    std::vector<Callback_sp> callbacks;
+    callbacks.reserve(n);
+    Timestamp earliest;
+    for (int i = 0; i < n; i++) {
+      Callback_sp cb = allocate_callback<CFunctionCallback>(
+        entry.pool, Timestamp(items[i].secs), items[i].func, items[i].data
+      );
+      if (i == 0 || cb->when < earliest) {
+        earliest = cb->when;
+      }
+      if (ids != NULL) {
+        ids[i] = cb->getCallbackId();
+      }
+      callbacks.push_back(cb);
+    }
+
+    bool wake = entry.ingress->push(callbacks);
+    // As in scheduleCallback().
+    if (entry.ingress->closed()) {
       return 0;
     }
-    return doExecLater(registry, func, data, delaySecs, true);
+    if (wake) {
+      wakeLoop(loop_id, earliest);
+    }
+    return n;
+  }
+
+  // Schedule a C function to run repeatedly on a loop, first after
+  // `delaySecs` seconds and then every `intervalSecs` seconds. Returns the
+  // callback ID, or 0 if the loop doesn't exist.
+  uint64_t scheduleRepeating(void (*func)(void*), void* data, double intervalSecs, double delaySecs,
+                             MissedTickPolicy missed, int loop_id) {
+    // This method can be called from any thread. Unlike scheduleCallback(),
+    // it adds the callback to the registry directly, since the registry has
+    // to know about the callback to reschedule it. That's done with the lock
+    // held, and with a raw pointer to the registry, so that it can't be
+    // destroyed on this thread.
+    uint64_t callback_id;
+    WakeChange change;
+    {
+      Guard guard(&mutex);
+      std::map<int, RegistryHandle>::iterator it = registries.find(loop_id);
+      if (it == registries.end()) {
+        return 0;
+      }
+      CallbackRegistry* registry = it->second.registry.get();
+
+      Callback_sp cb = allocate_callback<CFunctionCallback>(
+        registry->getPool(), Timestamp(delaySecs), func, data
+      );
+      cb->interval = intervalSecs;
+      cb->missed = missed;
+      callback_id = registry->addRepeating(cb, delaySecs, &change);
+    }
+    if (change.rootId == GLOBAL_LOOP) {
+      signalAutorunner(*change.wake);
+    }
+    return callback_id;
+  }
+
+  // Count a later_fd() wait on a loop, so that the loop isn't empty or pruned
+  // while the wait is active. Returns false if the loop doesn't exist. These
+  // can be called from any thread. Like wakeLoop(), they use a raw pointer
+  // with the lock held, so that the registry can't be destroyed on this
+  // thread; a wait only holds on to its loop's ID.
+  bool fdWaitsIncr(int loop_id) {
+    Guard guard(&mutex);
+    std::map<int, RegistryHandle>::iterator it = registries.find(loop_id);
+    if (it == registries.end()) {
+      return false;
+    }
+    it->second.registry.get()->fd_waits_incr();
+    return true;
+  }
+
+  // Stop counting a later_fd() wait. Does nothing if the loop has been
+  // removed since.
+  void fdWaitsDecr(int loop_id) {
+    Guard guard(&mutex);
+    std::map<int, RegistryHandle>::iterator it = registries.find(loop_id);
+    if (it != registries.end()) {
+      it->second.registry.get()->fd_waits_decr();
+    }
   }
 
   // This is called when the R loop handle referring to a CallbackRegistry is
@@ -187,18 +326,7 @@ public:
     // because there are no more shared_ptrs to it.
     shared_ptr<CallbackRegistry> parent = registry->parent;
     if (parent != nullptr) {
-      // Remove this registry from the parent's list of children.
-      for (std::vector<shared_ptr<CallbackRegistry> >::iterator it = parent->children.begin();
-           it != parent->children.end();
-          )
-      {
-        if (*it == registry) {
-          parent->children.erase(it);
-          break;
-        } else {
-          ++it;
-        }
-      }
+      parent->removeChild(registry);
     }
 
     // Tell the children that they no longer have a parent.
@@ -211,14 +339,66 @@ public:
 
     registries.erase(id);
 
+    // Background threads may still have the old snapshot, and push onto the
+    // ingress after this. Closing it tells them that the loop is gone.
+    registry->getIngress()->close();
+    std::shared_ptr<IngressMap> newIngresses = make_shared<IngressMap>(*std::atomic_load(&ingresses));
+    newIngresses->erase(id);
+    std::atomic_store(&ingresses, std::shared_ptr<const IngressMap>(newIngresses));
+
     return true;
   }
 
 private:
+  // Wake up anything that might be waiting to run a loop, after a callback
+  // due at `when` has been pushed onto the ingress queue of loop `loop_id`.
+  // The autorunner is only signalled if the callback moved the wake time of
+  // the global loop's tree earlier, as in doExecLater(), since it doesn't run
+  // any other loops.
+  void wakeLoop(int loop_id, const Timestamp& when) {
+    WakeChange change;
+    {
+      // Wake up CallbackRegistry::wait(), if it's running. This needs the
+      // lock so that the signal can't be sent between the waiter checking
+      // the queue and starting to wait.
+      Guard guard(&mutex);
+      // Let the loop and its ancestors know about the callback before it's
+      // drained. This uses a raw pointer so that the registry can't be
+      // destroyed on this thread; `registries` keeps it alive while the lock
+      // is held.
+      std::map<int, RegistryHandle>::iterator it = registries.find(loop_id);
+      if (it != registries.end()) {
+        CallbackRegistry* registry = it->second.registry.get();
+        registry->notePending(when, &change);
+      }
+      condvar.signal();
+    }
+    if (change.rootId == GLOBAL_LOOP) {
+      signalAutorunner(*change.wake);
+    }
+  }
+
   std::map<int, RegistryHandle> registries;
   Mutex mutex;
   ConditionVariable condvar;
 
+  // What scheduleCallback() needs to add a callback to a loop from any
+  // thread: the loop's ingress queue, and the pool to allocate it from.
+  struct IngressEntry {
+    IngressEntry() = default;
+    IngressEntry(std::shared_ptr<CallbackIngress> ingress, std::shared_ptr<CallbackPool> pool)
+      : ingress(ingress), pool(pool) {
+    }
+    std::shared_ptr<CallbackIngress> ingress;
+    std::shared_ptr<CallbackPool> pool;
+  };
+
+  // Copy-on-write map from loop ID to IngressEntry, for scheduleCallback().
+  // It is only replaced while `mutex` is held, but it is read without the
+  // lock, so it must be accessed with std::atomic_load().
+  typedef std::map<int, IngressEntry> IngressMap;
+  std::shared_ptr<const IngressMap> ingresses;
+
 };
 
 
@@ -2,12 +2,133 @@
 #include <Rcpp.h>
 #include <unistd.h>
 #include <cstdlib>
+#include <errno.h>
 #include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <list>
+#include <map>
 #include <memory>
+#include <unordered_map>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#endif
+#ifdef LATER_HAVE_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+#ifdef LATER_HAVE_LIBURING
+#include <liburing.h>
+#endif
 #include "tinycthread.h"
+#include "threadutils.h"
 #include "later.h"
 #include "callback_registry_table.h"
 
+// How later_fd() waits are done: with a thread for each wait, or by one
+// poller thread for all of them, using poll() (WSAPoll() on Windows), epoll or
+// io_uring. epoll is only available on Linux, and io_uring only if the
+// package was built with liburing.
+enum FdBackend {
+  FD_BACKEND_THREADS,
+  FD_BACKEND_EPOLL,
+  FD_BACKEND_IO_URING,
+  FD_BACKEND_POLL
+};
+
+// The part of a later_fd() wait that its canceller shares. Whichever of
+// fd_cancel() and later_callback() makes the wait inactive first releases its
+// hold on the loop, right away and on the main thread, so that loop_empty()
+// and the pruning of private loops don't have to wait for the waiting thread
+// to notice. A persistent watch stays active, and holds the loop, until it is
+// cancelled.
+//
+// The hold is a count kept through the CallbackRegistryTable, by loop ID. The
+// wait doesn't keep a reference to the registry, since the last reference to
+// a wait can be dropped on the waiting thread, and a registry must only be
+// destroyed on the main thread.
+class FdWaitControl {
+public:
+  // Takes over a hold on `loop` that has been counted with
+  // CallbackRegistryTable::fdWaitsIncr().
+  FdWaitControl(CallbackRegistryTable& table, int loop, bool persistent, bool revents)
+    : persistent(persistent), revents(revents), backend(FD_BACKEND_THREADS), active(true), table(table), loop(loop),
+      rearmed(false), rearmMutex(tct_mtx_plain), rearmCond(rearmMutex) {
+  }
+
+  bool isActive() const {
+    return active.load();
+  }
+
+  // Make the wait inactive and release its hold on the loop. Returns false
+  // if it was already inactive.
+  bool deactivate() {
+    bool still_active = true;
+    // atomic compare_exchange_strong:
+    // if active is true, it is changed to false (so future requests to fd_cancel return false)
+    // if active is false (already run or cancelled), still_active is changed to false
+    active.compare_exchange_strong(still_active, false);
+    if (!still_active)
+      return false;
+    table.fdWaitsDecr(loop);
+    return true;
+  }
+
+  // The R function to call, if any. Only used on the main thread, so that
+  // fd_cancel() can release it while the wait is still held by another
+  // thread.
+  std::unique_ptr<Rcpp::Function> callback = nullptr;
+  // The C function to call, if there's no R function.
+  std::function<void (int *)> callback_native = nullptr;
+  // The C function to call for later_read(), if there's no R function.
+  std::function<void (const char *, int)> callback_read = nullptr;
+
+  // Whether the watch keeps firing until it's cancelled.
+  const bool persistent;
+  // Whether the results are the raw revents of each fd, rather than 1/0/NA.
+  const bool revents;
+  // The FdBackend that waits for it. Set before the wait is started.
+  int backend;
+
+  // With a thread per wait, the thread of a persistent watch waits after each
+  // firing until the callback has run and calls rearm().
+  void rearm() {
+    Guard guard(&rearmMutex);
+    rearmed = true;
+    rearmCond.signal();
+  }
+
+  // Returns false if the watch was cancelled instead.
+  bool waitForRearm() {
+    Guard guard(&rearmMutex);
+    while (!rearmed) {
+      if (!isActive())
+        return false;
+      // Never wait for longer than ~1 second so we can check for cancellation
+      rearmCond.timedwait(1.024);
+    }
+    rearmed = false;
+    return isActive();
+  }
+
+private:
+  std::atomic<bool> active;
+  CallbackRegistryTable& table;
+  const int loop;
+  bool rearmed;
+  Mutex rearmMutex;
+  ConditionVariable rearmCond;
+};
+
 class ThreadArgs {
 public:
   ThreadArgs(
@@ -15,19 +136,25 @@ public:
     struct pollfd *fds,
     double timeout,
     int loop,
-    CallbackRegistryTable& table
+    CallbackRegistryTable& table,
+    bool persistent = false,
+    bool revents = false
   )
     : timeout(createTimestamp(timeout)),
-      active(std::make_shared<std::atomic<bool>>(true)),
       fds(std::vector<struct pollfd>(fds, fds + num_fds)),
       results(std::vector<int>(num_fds)),
-      loop(loop),
-      registry(table.getRegistry(loop)) {
+      readMax(0),
+      readResult(-ETIMEDOUT),
+      pid(0),
+      exited(false),
+      exitStatus(NA_INTEGER),
+      ownedFd(-1),
+      loop(loop) {
 
-    if (registry == nullptr)
+    if (!table.fdWaitsIncr(loop))
       throw std::runtime_error("CallbackRegistry does not exist.");
 
-    registry->fd_waits_incr();
+    control = std::make_shared<FdWaitControl>(table, loop, persistent, revents);
   }
 
   ThreadArgs(
@@ -36,9 +163,11 @@ public:
     struct pollfd *fds,
     double timeout,
     int loop,
-    CallbackRegistryTable& table
-  ) : ThreadArgs(num_fds, fds, timeout, loop, table) {
-    callback = std::unique_ptr<Rcpp::Function>(new Rcpp::Function(func));
+    CallbackRegistryTable& table,
+    bool persistent = false,
+    bool revents = false
+  ) : ThreadArgs(num_fds, fds, timeout, loop, table, persistent, revents) {
+    control->callback = std::unique_ptr<Rcpp::Function>(new Rcpp::Function(func));
   }
 
   ThreadArgs(
@@ -48,26 +177,58 @@ public:
     struct pollfd *fds,
     double timeout,
     int loop,
+    CallbackRegistryTable& table,
+    bool persistent = false,
+    bool revents = false
+  ) : ThreadArgs(num_fds, fds, timeout, loop, table, persistent, revents) {
+    control->callback_native = std::bind(func, std::placeholders::_1, data);
+  }
+
+  // A later_read() wait, on a single fd.
+  ThreadArgs(
+    void (*func)(const char *, int, void *),
+    void *data,
+    struct pollfd *fd,
+    int readMax,
+    double timeout,
+    int loop,
     CallbackRegistryTable& table
-  ) : ThreadArgs(num_fds, fds, timeout, loop, table) {
-    callback_native = std::bind(func, std::placeholders::_1, data);
+  ) : ThreadArgs(1, fd, timeout, loop, table) {
+    this->readMax = readMax;
+    control->callback_read = std::bind(func, std::placeholders::_1, std::placeholders::_2, data);
   }
 
   ~ThreadArgs() {
-    registry->fd_waits_decr();
+    // Normally the wait has been run or cancelled by now. If it couldn't be
+    // started, this releases its hold on the loop.
+    control->deactivate();
+#ifndef _WIN32
+    if (ownedFd >= 0)
+      close(ownedFd);
+#endif
   }
 
   Timestamp timeout;
-  std::shared_ptr<std::atomic<bool>> active;
-  std::unique_ptr<Rcpp::Function> callback = nullptr;
-  std::function<void (int *)> callback_native = nullptr;
+  std::shared_ptr<FdWaitControl> control;
   std::vector<struct pollfd> fds;
   std::vector<int> results;
+  // For later_read(): the most bytes to read once the fd is ready, or 0 if
+  // this isn't a read. The result is the number of bytes read, 0 at end of
+  // file, or a negative errno; -ETIMEDOUT until the read is done.
+  int readMax;
+  int readResult;
+  std::vector<char> data;
+  // For later_pid(): the process to wait for, or 0 if this isn't a process
+  // wait, and whether it has exited and with what status.
+  int pid;
+  bool exited;
+  int exitStatus;
+  // An fd that belongs to the wait, and is closed with it, or -1: the pidfd
+  // of a later_pid() wait, or the inotify instance of a later_file() watch.
+  int ownedFd;
   const int loop;
 
 private:
-  std::shared_ptr<CallbackRegistry> registry;
-
   static Timestamp createTimestamp(double timeout) {
     if (timeout > 3e10) {
       timeout = 3e10; // "1000 years ought to be enough for anybody" --Bill Gates
@@ -79,34 +240,264 @@ private:
 
 };
 
+// The results as an R vector: logical, or integer for raw revents. It's
+// allocated here, on the main thread, and filled straight from the results.
+static Rcpp::RObject results_vector(const FdWaitControl& control, const std::vector<int>& results) {
+  if (control.revents)
+    return Rcpp::IntegerVector(results.begin(), results.end());
+  return Rcpp::LogicalVector(results.begin(), results.end());
+}
+
+// The result of a later_read() as an R object: the bytes read (none at end of
+// file), NULL if the wait timed out, or the error message if the read failed.
+static Rcpp::RObject read_result(const ThreadArgs& args) {
+  if (args.readResult >= 0)
+    return Rcpp::RawVector(args.data.begin(), args.data.end());
+  if (args.readResult == -ETIMEDOUT)
+    return R_NilValue;
+  return Rcpp::CharacterVector::create(std::strerror(-args.readResult));
+}
+
+// The result of a later_pid() as an R object: the exit status, or NULL if the
+// wait timed out.
+static Rcpp::RObject pid_result(const ThreadArgs& args) {
+  if (!args.exited)
+    return R_NilValue;
+  return Rcpp::IntegerVector::create(args.exitStatus);
+}
+
 static void later_callback(void *arg) {
 
   ASSERT_MAIN_THREAD()
 
   std::unique_ptr<ThreadArgs> args(static_cast<ThreadArgs *>(arg));
-  bool still_active = true;
-  // atomic compare_exchange_strong:
-  // if args->active is true, it is changed to false (so future requests to fd_cancel return false)
-  // if args->active is false (cancelled), still_active is changed to false
-  args->active->compare_exchange_strong(still_active, false);
-  if (!still_active)
+  if (!args->control->deactivate())
+    return;
+  if (args->control->callback != nullptr) {
+    std::unique_ptr<Rcpp::Function> callback = std::move(args->control->callback);
+    if (args->readMax > 0) {
+      (*callback)(read_result(*args));
+    } else if (args->pid > 0) {
+      (*callback)(pid_result(*args));
+    } else {
+      (*callback)(results_vector(*args->control, args->results));
+    }
+  } else if (args->readMax > 0) {
+    args->control->callback_read(args->data.data(), args->readResult);
+  } else {
+    args->control->callback_native(args->results.data());
+  }
+
+}
+
+// Fill in args->results from the revents of a poll() call that returned
+// `ready`. If it timed out, the results stay as all 0. If poll() failed,
+// they're all NA, even for raw revents.
+static void set_results(ThreadArgs* args, int ready) {
+  if (ready > 0) {
+    const bool raw = args->control->revents;
+    for (std::size_t i = 0; i < args->fds.size(); i++) {
+      const int revents = (args->fds)[i].revents;
+      (args->results)[i] = raw ? revents : revents == 0 ? 0 : revents & (POLLIN | POLLOUT) ? 1: NA_INTEGER;
+    }
+  } else if (ready < 0) {
+    std::fill(args->results.begin(), args->results.end(), NA_INTEGER);
+  }
+}
+
+// The largest read buffer a waiting thread keeps between reads.
+static const std::size_t READ_BUFFER_KEEP = 1 << 20;
+
+#ifndef _WIN32
+// Read from `fd` without blocking, even if it's in blocking mode. poll()
+// reporting it as readable doesn't mean that a read won't block: another
+// reader may have drained it in between, or the readiness may have been
+// spurious. A read that blocked would stall every other wait on the poller
+// thread. Sockets are read with MSG_DONTWAIT; anything else is put in
+// non-blocking mode for the read, and then put back.
+static ssize_t read_nonblocking(int fd, char* buffer, std::size_t size) {
+  ssize_t n = recv(fd, buffer, size, MSG_DONTWAIT);
+  if (n >= 0 || errno != ENOTSOCK)
+    return n;
+
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0)
+    return -1;
+  if (flags & O_NONBLOCK)
+    return read(fd, buffer, size);
+  if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)
+    return -1;
+  n = read(fd, buffer, size);
+  int saved_errno = errno;
+  fcntl(fd, F_SETFL, flags);
+  errno = saved_errno;
+  return n;
+}
+#endif
+
+// For a later_read() wait, read from its fd once a poll() call has returned
+// `ready`. The read goes into `buffer`, which the waiting thread reuses, and
+// only the bytes read are kept. Returns false if there was nothing to read
+// after all, so that the wait goes on.
+static bool read_fd(ThreadArgs* args, int ready, std::vector<char>& buffer) {
+  if (ready < 0) {
+#ifdef _WIN32
+    args->readResult = -EIO;
+#else
+    args->readResult = -errno;
+#endif
+    return true;
+  }
+
+  if (buffer.size() < static_cast<std::size_t>(args->readMax))
+    buffer.resize(args->readMax);
+#ifdef _WIN32
+  // Whether a socket is in blocking mode can't be checked on Windows, so
+  // only what has already arrived is read. With nothing there, recv() only
+  // returns right away at end of file or after an error; otherwise something
+  // else has read the data first, and the wait goes on.
+  SOCKET sock = static_cast<SOCKET>(args->fds[0].fd);
+  u_long available = 0;
+  if (ioctlsocket(sock, FIONREAD, &available) == SOCKET_ERROR) {
+    args->readResult = -EIO;
+    return true;
+  }
+  int want = args->readMax;
+  if (available == 0) {
+    if (!(args->fds[0].revents & (POLLHUP | POLLERR)))
+      return false;
+  } else if (available < static_cast<u_long>(want)) {
+    want = static_cast<int>(available);
+  }
+  int n = recv(sock, buffer.data(), want, 0);
+  if (n == SOCKET_ERROR) {
+    if (WSAGetLastError() == WSAEWOULDBLOCK)
+      return false;
+    args->readResult = -EIO;
+    return true;
+  }
+#else
+  ssize_t n = read_nonblocking(args->fds[0].fd, buffer.data(), args->readMax);
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return false;
+    args->readResult = -errno;
+    return true;
+  }
+#endif
+  args->readResult = static_cast<int>(n);
+  args->data.assign(buffer.data(), buffer.data() + n);
+  if (buffer.size() > READ_BUFFER_KEEP)
+    std::vector<char>().swap(buffer);
+  return true;
+}
+
+#ifndef _WIN32
+// Whether process `pid` has exited, and if so, its exit status: the exit code,
+// or minus the number of the signal that killed it. The process isn't reaped,
+// so that whoever started it still gets its status. The status is NA if the
+// process isn't a child of this one, or has been reaped already.
+static bool pid_exited(int pid, int* status) {
+  siginfo_t info;
+  std::memset(&info, 0, sizeof(info));
+  int res;
+  do {
+    res = waitid(P_PID, static_cast<id_t>(pid), &info, WEXITED | WNOHANG | WNOWAIT);
+  } while (res != 0 && errno == EINTR);
+
+  if (res != 0) {
+    if (kill(pid, 0) != 0 && errno == ESRCH) {
+      *status = NA_INTEGER;
+      return true;
+    }
+    return false;
+  }
+  if (info.si_pid == 0)
+    return false;
+  *status = info.si_code == CLD_EXITED ? info.si_status : -info.si_status;
+  return true;
+}
+#endif
+
+// Finish a later_read() or later_pid() wait on the waiting thread, once a
+// poll() call has returned `ready`. Returns false if the wait should go on.
+// Other waits are left alone.
+static bool complete_wait(ThreadArgs* args, int ready, std::vector<char>& buffer) {
+  if (args->readMax > 0)
+    return read_fd(args, ready, buffer);
+#ifndef _WIN32
+  if (args->pid > 0 && ready != 0) {
+    // The pidfd is readable once the process has exited.
+    args->exited = true;
+    if (ready < 0 || !pid_exited(args->pid, &args->exitStatus))
+      args->exitStatus = NA_INTEGER;
+  }
+#endif
+  return true;
+}
+
+// Hand a finished wait over to the main thread, which runs its callback.
+static void deliver(std::unique_ptr<ThreadArgs> args) {
+  int loop_id = args->loop;
+  callbackRegistryTable.scheduleCallback(later_callback, static_cast<void *>(args.release()), 0, loop_id);
+}
+
+// Let a persistent watch fire again, once its callback has run. Defined
+// below, for each way of waiting.
+static void rearm_wait(const std::shared_ptr<FdWaitControl>& control);
+
+// One firing of a persistent watch, on its way to the main thread. The
+// waiting thread keeps the watch, but doesn't report it again until the
+// callback has run, so there is never more than one of these per watch.
+struct FdFiring {
+  std::shared_ptr<FdWaitControl> control;
+  std::vector<int> results;
+};
+
+static void watch_callback(void *arg) {
+
+  ASSERT_MAIN_THREAD()
+
+  std::unique_ptr<FdFiring> firing(static_cast<FdFiring *>(arg));
+  const std::shared_ptr<FdWaitControl>& control = firing->control;
+  if (!control->isActive())
     return;
-  if (args->callback != nullptr) {
-    Rcpp::LogicalVector results(args->results.begin(), args->results.end());
-    (*args->callback)(results);
+
+  // Rearm even if the callback throws, unless it cancelled the watch.
+  struct RearmOnExit {
+    const std::shared_ptr<FdWaitControl>& control;
+    ~RearmOnExit() {
+      if (control->isActive())
+        rearm_wait(control);
+    }
+  } rearm = { control };
+
+  if (control->callback != nullptr) {
+    // A copy, because the callback may cancel the watch, which releases it.
+    Rcpp::Function callback = *control->callback;
+    callback(results_vector(*control, firing->results));
   } else {
-    args->callback_native(args->results.data());
+    control->callback_native(firing->results.data());
   }
 
 }
 
+// Hand the current results of a persistent watch over to the main thread.
+static void fire(ThreadArgs* args) {
+  FdFiring* firing = new FdFiring{args->control, args->results};
+  callbackRegistryTable.scheduleCallback(watch_callback, static_cast<void *>(firing), 0, args->loop);
+}
+
 // CONSIDER: if necessary to add method for HANDLES on Windows. Would be different code to SOCKETs.
-// TODO: implement re-usable background thread.
+// Without a poller, each wait gets its own thread. A cancelled wait releases
+// its loop and its R function at once, but its thread only notices within
+// about a second.
 static int wait_thread(void *arg) {
 
   tct_thrd_detach(tct_thrd_current());
 
   std::unique_ptr<ThreadArgs> args(static_cast<ThreadArgs *>(arg));
+  std::vector<char> buffer;
 
   int ready;
   double waitFor = std::fmax(args->timeout.diff_secs(Timestamp()), 0);
@@ -114,62 +505,1422 @@ static int wait_thread(void *arg) {
     // Never wait for longer than ~1 second so we can check for cancellation
     waitFor = std::fmin(waitFor, 1.024);
     ready = LATER_POLL_FUNC(args->fds.data(), static_cast<LATER_NFDS_T>(args->fds.size()), static_cast<int>(waitFor * 1000));
-    if (!args->active->load()) return 1;
-    if (ready) break;
+    if (!args->control->isActive()) return 1;
+    if (ready) {
+      if (complete_wait(args.get(), ready, buffer)) break;
+      // Nothing to read after all.
+      ready = 0;
+    }
   } while ((waitFor = args->timeout.diff_secs(Timestamp())) > 0);
 
-  if (ready > 0) {
+  set_results(args.get(), ready);
+  deliver(std::move(args));
+
+  return 0;
+
+}
+
+// A persistent watch polls on its own thread until it's cancelled. After each
+// firing, the thread waits for the callback to run before polling again.
+static int watch_thread(void *arg) {
+
+  tct_thrd_detach(tct_thrd_current());
+
+  std::unique_ptr<ThreadArgs> args(static_cast<ThreadArgs *>(arg));
+
+  while (true) {
+    // Never wait for longer than ~1 second so we can check for cancellation
+    int ready = LATER_POLL_FUNC(args->fds.data(), static_cast<LATER_NFDS_T>(args->fds.size()), 1024);
+    if (!args->control->isActive()) return 1;
+    if (!ready) continue;
+    set_results(args.get(), ready);
+    fire(args.get());
+    if (!args->control->waitForRearm()) return 1;
+  }
+
+}
+
+static bool start_thread(std::unique_ptr<ThreadArgs>& args) {
+  tct_thrd_t thr;
+  tct_thrd_start_t func = args->control->persistent ? &watch_thread : &wait_thread;
+  if (tct_thrd_create(&thr, func, static_cast<void *>(args.get())) != tct_thrd_success)
+    return false;
+  args.release();
+  return true;
+}
+
+#ifndef _WIN32
+static void poller_after_fork();
+#endif
+
+// A single background thread that waits for all later_fd() calls in the
+// process, using epoll. Creating a thread for every call is too expensive
+// when there are thousands of calls a second.
+//
+// Other threads hand waits, cancellations and rearms to the poller through
+// lock-free stacks and wake it with wake_fd, so a cancelled wait is removed
+// from the epoll set and freed right away. Everything else is owned by the
+// poller thread. Each file descriptor is added to the epoll set once, with the
+// union of the events that the waits on it are interested in, because epoll
+// doesn't allow the same descriptor to be added twice. When epoll says that a
+// descriptor is ready, each wait that includes it polls all of its
+// descriptors without blocking, so that the results are exactly what poll()
+// would have reported.
+//
+// Where there's no epoll, the poller calls poll() on one array with an entry
+// for each fd, built from the same records, instead of each wait having its
+// own thread. The array is rebuilt when the fds or their events change.
+//
+// A persistent watch is level-triggered. When it fires, its fds are taken out
+// of the epoll set until its callback has run on the main thread and it's
+// rearmed, so a busy fd can't flood the loop, nor keep the poller spinning.
+//
+// With io_uring, the poller submits a one-shot IORING_OP_POLL_ADD for each fd
+// instead of adding it to an epoll set, and submits it again after it
+// completes if the fd is still watched, which makes it level-triggered too.
+// Timeouts don't use linked timeout requests, because a wait's timeout covers
+// all of its fds; the poller waits for completions with a timeout for the
+// earliest deadline, as with epoll.
+class FdPoller {
+public:
+  explicit FdPoller(int backend) : backend(backend), incoming(nullptr), requests(nullptr),
+    started(false), wake_fd(-1), wake_write_fd(-1), startMutex(tct_mtx_plain), pollSetChanged(true)
+#ifdef LATER_HAVE_EPOLL
+    , epoll_fd(-1), epollEvents(64)
+#endif
+#ifdef LATER_HAVE_LIBURING
+    , nextGen(1)
+#endif
+  {
+#ifdef LATER_HAVE_LIBURING
+    ring.ring_fd = -1;
+#endif
+  }
+
+  // Start the poller thread, if it isn't running. Can be called from any
+  // thread. Returns false if it couldn't be started.
+  bool start() {
+    if (started.load()) {
+      return true;
+    }
+    Guard guard(&startMutex);
+    if (started.load()) {
+      return true;
+    }
+#ifndef _WIN32
+    static int atfork = pthread_atfork(NULL, NULL, poller_after_fork);
+    (void) atfork;
+#endif
+
+    tct_thrd_t thr;
+    if (!openWake() ||
+        !openBackend() ||
+        tct_thrd_create(&thr, &thread_main, static_cast<void *>(this)) != tct_thrd_success) {
+      closeBackend();
+      closeWake();
+      return false;
+    }
+    tct_thrd_detach(thr);
+    started = true;
+    return true;
+  }
+
+  // Start waiting, and take ownership of args. Can be called from any thread.
+  // Returns false, and leaves args alone, if the poller thread couldn't be
+  // started.
+  bool add(std::unique_ptr<ThreadArgs>& args) {
+    if (!start()) {
+      return false;
+    }
+    Pending* node = new Pending();
+    node->args = std::move(args);
+    node->next = incoming.load();
+    while (!incoming.compare_exchange_weak(node->next, node)) {
+    }
+    wake();
+    return true;
+  }
+
+  // Stop waiting for a wait that has been cancelled. Main thread only.
+  void cancel(const std::shared_ptr<FdWaitControl>& control) {
+    request(control, false);
+  }
+
+  // Watch the fds of a persistent watch again, after its callback has run.
+  // Main thread only.
+  void rearm(const std::shared_ptr<FdWaitControl>& control) {
+    request(control, true);
+  }
+
+  // In a forked child, the poller thread doesn't exist. Forget about the
+  // parent's waits, which can't complete, and start a new thread on demand.
+  void afterFork() {
+    started = false;
+    closeBackend();
+    closeWake();
+    for (std::list<Watch>::iterator it = watches.begin(); it != watches.end(); ++it) {
+      it->args.release();
+    }
+    watches.clear();
+    deadlines.clear();
+    fds.clear();
+    byControl.clear();
+    pollSetChanged = true;
+    incoming.store(nullptr);
+    requests.store(nullptr);
+  }
+
+private:
+  struct Pending {
+    std::unique_ptr<ThreadArgs> args;
+    Pending* next;
+  };
+
+  // A cancellation, or a rearm of a persistent watch.
+  struct Request {
+    std::shared_ptr<FdWaitControl> control;
+    bool rearm;
+    Request* next;
+  };
+
+  struct Watch {
+    std::unique_ptr<ThreadArgs> args;
+    std::list<Watch>::iterator self;
+    // deadlines.end() for a persistent watch, which has no timeout.
+    std::multimap<Timestamp, Watch*>::iterator deadline;
+    // Whether an fd of this watch was reported by the current wait.
+    bool flagged;
+    // Whether this persistent watch has fired, and its callback hasn't run
+    // yet. Its fds aren't watched meanwhile.
+    bool paused;
+  };
+
+  // The waits on one file descriptor, with the events each is interested
+  // in, and the union of those events, which is what it's watched for.
+  struct FdEntry {
+    FdEntry() : events(0)
+#ifdef LATER_HAVE_LIBURING
+      , armed(0), failed(false)
+#endif
+    {}
+    uint32_t events;
+    std::vector<std::pair<Watch*, uint32_t> > watchers;
+#ifdef LATER_HAVE_LIBURING
+    // The user data of the pending io_uring poll for the fd, or 0 if none.
+    uint64_t armed;
+    // Whether the last poll failed, for example because the fd is invalid.
+    // It isn't submitted again until the watchers change.
+    bool failed;
+#endif
+  };
+
+  // The FdBackend used to wait: FD_BACKEND_POLL, FD_BACKEND_EPOLL or
+  // FD_BACKEND_IO_URING.
+  const int backend;
+
+  // Waits added, cancelled and rearmed by other threads, in reverse order,
+  // not yet seen by the poller thread.
+  std::atomic<Pending*> incoming;
+  std::atomic<Request*> requests;
+  std::atomic<bool> started;
+  // Readable when the poller thread has been woken. It's written to through
+  // wake_write_fd, which may be the same fd.
+  int wake_fd;
+  int wake_write_fd;
+  Mutex startMutex;
+
+  // Only used by the poller thread.
+  std::list<Watch> watches;
+  std::multimap<Timestamp, Watch*> deadlines;
+  std::unordered_map<int, FdEntry> fds;
+  std::unordered_map<const FdWaitControl*, Watch*> byControl;
+
+  // The array passed to poll(): wake_fd, and then each watched fd.
+  std::vector<struct pollfd> pollSet;
+  bool pollSetChanged;
+  // Reused by each later_read() wait.
+  std::vector<char> readBuffer;
+
+#ifdef LATER_HAVE_EPOLL
+  int epoll_fd;
+  std::vector<struct epoll_event> epollEvents;
+#endif
+
+#ifdef LATER_HAVE_LIBURING
+  struct io_uring ring;
+  // The user data of a poll is its generation in the top 32 bits and the fd
+  // in the bottom 32, so that the completion of a poll that has since been
+  // removed or replaced can be told apart from the current one. These values
+  // are never used for polls of watched fds.
+  static const uint64_t REMOVE_DATA = 0;
+  static const uint64_t WAKE_DATA = 1;
+  uint32_t nextGen;
+#endif
+
+  // Set up io_uring or epoll, watching wake_fd. poll() needs nothing.
+  bool openBackend() {
+#ifdef LATER_HAVE_LIBURING
+    if (backend == FD_BACKEND_IO_URING) {
+      if (io_uring_queue_init(256, &ring, 0) < 0) {
+        ring.ring_fd = -1;
+        return false;
+      }
+      pollAdd(wake_fd, POLLIN, WAKE_DATA);
+      return true;
+    }
+#endif
+#ifdef LATER_HAVE_EPOLL
+    if (backend == FD_BACKEND_EPOLL) {
+      epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+      if (epoll_fd < 0) {
+        return false;
+      }
+      struct epoll_event ev = {};
+      ev.events = EPOLLIN;
+      ev.data.fd = wake_fd;
+      return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &ev) == 0;
+    }
+#endif
+    pollSetChanged = true;
+    return true;
+  }
+
+  void closeBackend() {
+#ifdef LATER_HAVE_LIBURING
+    if (ring.ring_fd >= 0) {
+      io_uring_queue_exit(&ring);
+      ring.ring_fd = -1;
+    }
+#endif
+#ifdef LATER_HAVE_EPOLL
+    if (epoll_fd >= 0) {
+      close(epoll_fd);
+      epoll_fd = -1;
+    }
+#endif
+  }
+
+  // The poller thread is woken by making wake_fd readable. It's an eventfd
+  // on Linux, and a pipe on other Unixes. On Windows, where WSAPoll() only
+  // takes sockets, it's a loopback UDP socket that sends to itself.
+  bool openWake() {
+#if defined(_WIN32)
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+      return false;
+    }
+    SOCKET sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == INVALID_SOCKET) {
+      WSACleanup();
+      return false;
+    }
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int len = sizeof(addr);
+    u_long nonblocking = 1;
+    if (bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        getsockname(sock, reinterpret_cast<struct sockaddr *>(&addr), &len) != 0 ||
+        connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        ioctlsocket(sock, FIONBIO, &nonblocking) != 0) {
+      closesocket(sock);
+      WSACleanup();
+      return false;
+    }
+    wake_fd = wake_write_fd = static_cast<int>(sock);
+#elif defined(LATER_HAVE_EPOLL)
+    wake_fd = wake_write_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#else
+    int pipe_fds[2];
+    if (pipe(pipe_fds) != 0) {
+      return false;
+    }
+    for (int i = 0; i < 2; i++) {
+      fcntl(pipe_fds[i], F_SETFL, fcntl(pipe_fds[i], F_GETFL) | O_NONBLOCK);
+      fcntl(pipe_fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    wake_fd = pipe_fds[0];
+    wake_write_fd = pipe_fds[1];
+#endif
+    return wake_fd >= 0;
+  }
+
+  void closeWake() {
+    if (wake_fd < 0) {
+      return;
+    }
+#ifdef _WIN32
+    closesocket(static_cast<SOCKET>(wake_fd));
+    WSACleanup();
+#else
+    if (wake_write_fd != wake_fd) {
+      close(wake_write_fd);
+    }
+    close(wake_fd);
+#endif
+    wake_fd = wake_write_fd = -1;
+  }
+
+  void request(const std::shared_ptr<FdWaitControl>& control, bool rearm) {
+    if (!started.load()) {
+      return;
+    }
+    Request* node = new Request();
+    node->control = control;
+    node->rearm = rearm;
+    node->next = requests.load();
+    while (!requests.compare_exchange_weak(node->next, node)) {
+    }
+    wake();
+  }
+
+  void wake() {
+#ifdef _WIN32
+    char byte = 0;
+    send(static_cast<SOCKET>(wake_write_fd), &byte, 1, 0);
+#else
+    uint64_t one = 1;
+    ssize_t cbytes = write(wake_write_fd, &one, sizeof(one));
+    (void)cbytes; // squelch compiler warning
+#endif
+  }
+
+  void drainWake() {
+#ifdef _WIN32
+    char buf[64];
+    while (recv(static_cast<SOCKET>(wake_fd), buf, sizeof(buf), 0) > 0) {
+    }
+#else
+    uint64_t buf[8];
+    while (read(wake_fd, buf, sizeof(buf)) > 0) {
+    }
+#endif
+  }
+
+  static int thread_main(void* data) {
+    static_cast<FdPoller*>(data)->run();
+    return 0;
+  }
+
+  void run() {
+    std::vector<int> ready;
+    std::vector<Watch*> flagged;
+
+    while (true) {
+      takeIncoming();
+      takeRequests();
+
+      Timestamp now;
+      int timeout_ms = -1;
+      if (!deadlines.empty()) {
+        // Cap the wait so that it fits in an int of milliseconds.
+        double waitFor = std::fmin(deadlines.begin()->first.diff_secs(now), 86400);
+        timeout_ms = waitFor > 0 ? static_cast<int>(std::ceil(waitFor * 1000)) : 0;
+      }
+
+      ready.clear();
+      waitFds(timeout_ms, ready);
+
+      flagged.clear();
+      for (std::size_t i = 0; i < ready.size(); i++) {
+        std::unordered_map<int, FdEntry>::iterator it = fds.find(ready[i]);
+        if (it == fds.end()) {
+          continue;
+        }
+        for (std::size_t j = 0; j < it->second.watchers.size(); j++) {
+          Watch* w = it->second.watchers[j].first;
+          if (!w->flagged) {
+            w->flagged = true;
+            flagged.push_back(w);
+          }
+        }
+      }
+      for (std::size_t i = 0; i < flagged.size(); i++) {
+        flagged[i]->flagged = false;
+        check(flagged[i]);
+      }
+      rearmFds(ready);
+
+      now = Timestamp();
+      while (!deadlines.empty() && !(now < deadlines.begin()->first)) {
+        // Timed out: the results are all 0.
+        finish(deadlines.begin()->second);
+      }
+    }
+  }
+
+  // Wait for up to timeout_ms, or with no limit if it's -1, and add the fds
+  // that are ready to `ready`.
+  void waitFds(int timeout_ms, std::vector<int>& ready) {
+#ifdef LATER_HAVE_LIBURING
+    if (backend == FD_BACKEND_IO_URING) {
+      waitUring(timeout_ms, ready);
+      return;
+    }
+#endif
+#ifdef LATER_HAVE_EPOLL
+    if (backend == FD_BACKEND_EPOLL) {
+      int n = epoll_wait(epoll_fd, epollEvents.data(), static_cast<int>(epollEvents.size()), timeout_ms);
+      if (n < 0 && errno != EINTR) {
+        // Shouldn't happen, but don't spin.
+        tct_thrd_yield();
+      }
+      for (int i = 0; i < n; i++) {
+        if (epollEvents[i].data.fd == wake_fd) {
+          drainWake();
+        } else {
+          ready.push_back(epollEvents[i].data.fd);
+        }
+      }
+      if (n == static_cast<int>(epollEvents.size())) {
+        epollEvents.resize(epollEvents.size() * 2);
+      }
+      return;
+    }
+#endif
+    waitPoll(timeout_ms, ready);
+  }
+
+  void waitPoll(int timeout_ms, std::vector<int>& ready) {
+    if (pollSetChanged) {
+      struct pollfd pfd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      pollSet.clear();
+      pfd.fd = wake_fd;
+      pollSet.push_back(pfd);
+      for (std::unordered_map<int, FdEntry>::iterator it = fds.begin(); it != fds.end(); ++it) {
+        pfd.fd = it->first;
+        pfd.events = static_cast<short>(it->second.events);
+        pollSet.push_back(pfd);
+      }
+      pollSetChanged = false;
+    }
+
+    int n = LATER_POLL_FUNC(pollSet.data(), static_cast<LATER_NFDS_T>(pollSet.size()), timeout_ms);
+    if (n < 0) {
+#ifndef _WIN32
+      if (errno == EINTR) {
+        return;
+      }
+#endif
+      // WSAPoll() fails outright if any of the fds isn't a socket. Have
+      // every wait poll its own fds, so that only the ones with a bad fd fail.
+      for (std::size_t i = 1; i < pollSet.size(); i++) {
+        ready.push_back(static_cast<int>(pollSet[i].fd));
+      }
+      tct_thrd_yield();
+      return;
+    }
+    if (pollSet[0].revents != 0) {
+      drainWake();
+      n--;
+    }
+    for (std::size_t i = 1; i < pollSet.size() && n > 0; i++) {
+      if (pollSet[i].revents != 0) {
+        ready.push_back(static_cast<int>(pollSet[i].fd));
+        n--;
+      }
+    }
+  }
+
+  // Watch an fd for `events`, instead of what it was watched for before.
+  // Returns false if it can't be watched, because it's invalid or because
+  // it's a regular file, in which case poll() should be asked about it.
+  bool setFdEvents(int fd, FdEntry& entry, uint32_t events, bool added) {
+#ifdef LATER_HAVE_LIBURING
+    if (backend == FD_BACKEND_IO_URING) {
+      // A poll that can't be done completes right away with an error.
+      if (entry.armed != 0) {
+        pollRemove(entry.armed);
+      }
+      entry.armed = pollAdd(fd, events);
+      entry.failed = false;
+      return true;
+    }
+#endif
+#ifdef LATER_HAVE_EPOLL
+    if (backend == FD_BACKEND_EPOLL) {
+      struct epoll_event ev = {};
+      ev.events = events;
+      ev.data.fd = fd;
+      int res = epoll_ctl(epoll_fd, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+      if (res < 0 && !added && errno == ENOENT) {
+        // The fd was closed, which removed it from the epoll set, and its
+        // number has been reused.
+        res = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+      }
+      return res == 0;
+    }
+#endif
+    (void) fd; (void) entry; (void) events; (void) added;
+    pollSetChanged = true;
+    return true;
+  }
+
+  // Stop watching an fd.
+  void clearFd(int fd, FdEntry& entry) {
+#ifdef LATER_HAVE_LIBURING
+    if (backend == FD_BACKEND_IO_URING) {
+      if (entry.armed != 0) {
+        pollRemove(entry.armed);
+        entry.armed = 0;
+      }
+      return;
+    }
+#endif
+#ifdef LATER_HAVE_EPOLL
+    if (backend == FD_BACKEND_EPOLL) {
+      // This fails if the fd has been closed, which removes it anyway.
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+      return;
+    }
+#endif
+    (void) fd; (void) entry;
+    pollSetChanged = true;
+  }
+
+  // io_uring polls are one-shot. Poll again for the fds that completed and
+  // are still watched.
+  void rearmFds(const std::vector<int>& ready) {
+#ifdef LATER_HAVE_LIBURING
+    if (backend != FD_BACKEND_IO_URING) {
+      return;
+    }
+    for (std::size_t i = 0; i < ready.size(); i++) {
+      std::unordered_map<int, FdEntry>::iterator it = fds.find(ready[i]);
+      if (it != fds.end() && it->second.armed == 0 && !it->second.failed) {
+        it->second.armed = pollAdd(ready[i], it->second.events);
+      }
+    }
+#else
+    (void) ready;
+#endif
+  }
+
+#ifdef LATER_HAVE_LIBURING
+  struct io_uring_sqe* getSqe() {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+    while (sqe == NULL) {
+      // The submission queue is full.
+      io_uring_submit(&ring);
+      sqe = io_uring_get_sqe(&ring);
+    }
+    return sqe;
+  }
+
+  // Submit a poll, and return its user data.
+  uint64_t pollAdd(int fd, uint32_t events, uint64_t data = 0) {
+    if (data == 0) {
+      data = (static_cast<uint64_t>(nextGen) << 32) | static_cast<uint32_t>(fd);
+      if (++nextGen == 0xffffffff) {
+        // Never use all ones, which liburing uses for its own timeouts.
+        nextGen = 1;
+      }
+    }
+    struct io_uring_sqe* sqe = getSqe();
+    io_uring_prep_poll_add(sqe, fd, events);
+    sqe->user_data = data;
+    return data;
+  }
+
+  void pollRemove(uint64_t data) {
+    struct io_uring_sqe* sqe = getSqe();
+    // io_uring_prep_poll_remove() takes a pointer in older versions of
+    // liburing, so fill in the request here.
+    io_uring_prep_nop(sqe);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->addr = data;
+    sqe->user_data = REMOVE_DATA;
+  }
+
+  void waitUring(int timeout_ms, std::vector<int>& ready) {
+    struct io_uring_cqe* cqe = NULL;
+    int res;
+    if (timeout_ms < 0) {
+      res = io_uring_submit_and_wait(&ring, 1);
+    } else {
+      io_uring_submit(&ring);
+      struct __kernel_timespec ts;
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+      res = io_uring_wait_cqe_timeout(&ring, &cqe, &ts);
+    }
+    if (res < 0 && res != -ETIME && res != -EINTR) {
+      // Shouldn't happen, but don't spin.
+      tct_thrd_yield();
+    }
+
+    unsigned head;
+    unsigned count = 0;
+    io_uring_for_each_cqe(&ring, head, cqe) {
+      count++;
+      uint64_t data = cqe->user_data;
+      if (data == WAKE_DATA) {
+        drainWake();
+        pollAdd(wake_fd, POLLIN, WAKE_DATA);
+        continue;
+      }
+      int fd = static_cast<int>(static_cast<uint32_t>(data));
+      std::unordered_map<int, FdEntry>::iterator it = fds.find(fd);
+      if ((data >> 32) == 0 || data == ~static_cast<uint64_t>(0) ||
+          it == fds.end() || it->second.armed != data) {
+        // A removal, or a poll that has been removed or replaced.
+        continue;
+      }
+      it->second.armed = 0;
+      it->second.failed = cqe->res < 0;
+      ready.push_back(fd);
+    }
+    io_uring_cq_advance(&ring, count);
+  }
+#endif
+
+  void takeIncoming() {
+    Pending* list = incoming.exchange(nullptr);
+    // Reverse, so that waits are registered in the order they were added.
+    Pending* prev = nullptr;
+    while (list != nullptr) {
+      Pending* next = list->next;
+      list->next = prev;
+      prev = list;
+      list = next;
+    }
+    while (prev != nullptr) {
+      Pending* next = prev->next;
+      registerWatch(std::move(prev->args));
+      delete prev;
+      prev = next;
+    }
+  }
+
+  void takeRequests() {
+    Request* list = requests.exchange(nullptr);
+    while (list != nullptr) {
+      Request* next = list->next;
+      std::unordered_map<const FdWaitControl*, Watch*>::iterator it = byControl.find(list->control.get());
+      // If it's not there, it has already finished.
+      if (it != byControl.end()) {
+        Watch* w = it->second;
+        if (!list->rearm) {
+          drop(w);
+        } else if (w->paused) {
+          // If the fds are still ready, epoll reports them right away.
+          w->paused = false;
+          if (watchFds(w)) {
+            check(w);
+          }
+        }
+      }
+      delete list;
+      list = next;
+    }
+  }
+
+  void registerWatch(std::unique_ptr<ThreadArgs> args) {
+    if (!args->control->isActive()) {
+      // Cancelled before the poller saw it.
+      return;
+    }
+    watches.push_back(Watch());
+    Watch* w = &watches.back();
+    w->self = std::prev(watches.end());
+    w->args = std::move(args);
+    w->flagged = false;
+    w->paused = false;
+    if (w->args->control->persistent) {
+      w->deadline = deadlines.end();
+    } else {
+      w->deadline = deadlines.insert(std::make_pair(w->args->timeout, w));
+    }
+    byControl[w->args->control.get()] = w;
+
+    if (watchFds(w)) {
+      check(w);
+    }
+  }
+
+  // Start watching a watch's fds. Returns true if an fd couldn't be watched,
+  // in which case the watch should be checked right away; poll() reports on
+  // it.
+  bool watchFds(Watch* w) {
+    bool checkNow = false;
+    for (std::size_t i = 0; i < w->args->fds.size(); i++) {
+      const struct pollfd& pfd = w->args->fds[i];
+      FdEntry& entry = fds[pfd.fd];
+      uint32_t events = entry.events | static_cast<uint32_t>(pfd.events);
+      bool added = entry.watchers.empty();
+      entry.watchers.push_back(std::make_pair(w, static_cast<uint32_t>(pfd.events)));
+      if (added || events != entry.events) {
+        if (!setFdEvents(pfd.fd, entry, events, added)) {
+          checkNow = true;
+        }
+        entry.events = events;
+      }
+    }
+    return checkNow;
+  }
+
+  // Stop watching a watch's fds, unless other watches still want them.
+  void unwatchFds(Watch* w) {
+    ThreadArgs* args = w->args.get();
     for (std::size_t i = 0; i < args->fds.size(); i++) {
-      (args->results)[i] = (args->fds)[i].revents == 0 ? 0 : (args->fds)[i].revents & (POLLIN | POLLOUT) ? 1: NA_INTEGER;
+      int fd = args->fds[i].fd;
+      std::unordered_map<int, FdEntry>::iterator it = fds.find(fd);
+      if (it == fds.end()) {
+        continue;
+      }
+      FdEntry& entry = it->second;
+      uint32_t events = 0;
+      for (std::size_t j = 0; j < entry.watchers.size(); ) {
+        if (entry.watchers[j].first == w) {
+          entry.watchers.erase(entry.watchers.begin() + j);
+        } else {
+          events |= entry.watchers[j].second;
+          j++;
+        }
+      }
+      if (entry.watchers.empty()) {
+        clearFd(fd, entry);
+        fds.erase(it);
+      } else if (events != entry.events) {
+        setFdEvents(fd, entry, events, false);
+        entry.events = events;
+      }
     }
-  } else if (ready < 0) {
-    std::fill(args->results.begin(), args->results.end(), NA_INTEGER);
   }
 
-  int loop_id = args->loop;
-  callbackRegistryTable.scheduleCallback(later_callback, static_cast<void *>(args.release()), 0, loop_id);
+  // Poll the watch's fds without waiting, and finish it if any are ready,
+  // or fire it if it's persistent.
+  void check(Watch* w) {
+    ThreadArgs* args = w->args.get();
+    if (!args->control->isActive()) {
+      drop(w);
+      return;
+    }
+    int ready = LATER_POLL_FUNC(args->fds.data(), static_cast<LATER_NFDS_T>(args->fds.size()), 0);
+    if (ready == 0 || !complete_wait(args, ready, readBuffer)) {
+      // Whatever made the fd ready has already been handled.
+      return;
+    }
+    set_results(args, ready);
+    if (args->control->persistent) {
+      unwatchFds(w);
+      w->paused = true;
+      fire(args);
+    } else {
+      finish(w);
+    }
+  }
 
-  return 0;
+  // Stop watching and deliver the results, unless the wait was cancelled.
+  void finish(Watch* w) {
+    std::unique_ptr<ThreadArgs> args = remove(w);
+    if (args->control->isActive()) {
+      deliver(std::move(args));
+    }
+  }
+
+  void drop(Watch* w) {
+    remove(w);
+  }
+
+  // Stop watching a watch's fds, remove it from the poller's records, and
+  // return its arguments.
+  std::unique_ptr<ThreadArgs> remove(Watch* w) {
+    unwatchFds(w);
+    std::unique_ptr<ThreadArgs> args = std::move(w->args);
+    if (w->deadline != deadlines.end()) {
+      deadlines.erase(w->deadline);
+    }
+    byControl.erase(args->control.get());
+    watches.erase(w->self);
+    return args;
+  }
+};
+
+static FdPoller pollPoller(FD_BACKEND_POLL);
+#ifdef LATER_HAVE_EPOLL
+static FdPoller epollPoller(FD_BACKEND_EPOLL);
+#endif
+#ifdef LATER_HAVE_LIBURING
+static FdPoller uringPoller(FD_BACKEND_IO_URING);
+#endif
+
+#ifndef _WIN32
+static void poller_after_fork() {
+  pollPoller.afterFork();
+#ifdef LATER_HAVE_EPOLL
+  epollPoller.afterFork();
+#endif
+#ifdef LATER_HAVE_LIBURING
+  uringPoller.afterFork();
+#endif
+}
+#endif
 
+// The poller for a backend, or NULL for a thread per wait.
+static FdPoller* poller_for(int backend) {
+  switch (backend) {
+    case FD_BACKEND_POLL:
+      return &pollPoller;
+#ifdef LATER_HAVE_EPOLL
+    case FD_BACKEND_EPOLL:
+      return &epollPoller;
+#endif
+#ifdef LATER_HAVE_LIBURING
+    case FD_BACKEND_IO_URING:
+      return &uringPoller;
+#endif
+    default:
+      return NULL;
+  }
 }
 
-static SEXP execLater_fd_impl(const Rcpp::Function& callback, int num_fds, struct pollfd *fds, double timeout, int loop_id) {
+// The backend for new waits. It's epoll where that's available, and poll()
+// elsewhere, unless the LATER_FD_BACKEND environment variable says otherwise.
+// io_uring isn't the default: a pending io_uring poll holds a reference to
+// the file, so a socket that's closed while it's being waited on stays open
+// in the kernel, and its peer doesn't see the connection close, until the
+// wait ends.
+static std::atomic<int> fd_backend_choice(-1);
 
-  std::unique_ptr<ThreadArgs> args(new ThreadArgs(callback, num_fds, fds, timeout, loop_id, callbackRegistryTable));
-  std::shared_ptr<std::atomic<bool>> active = args->active;
-  tct_thrd_t thr;
+static int parse_fd_backend(const std::string& name) {
+  if (name == "threads")
+    return FD_BACKEND_THREADS;
+  if (name == "poll")
+    return FD_BACKEND_POLL;
+#ifdef LATER_HAVE_EPOLL
+  if (name == "epoll")
+    return FD_BACKEND_EPOLL;
+#endif
+#ifdef LATER_HAVE_LIBURING
+  if (name == "io_uring")
+    return FD_BACKEND_IO_URING;
+#endif
+  return -1;
+}
+
+static const char* fd_backend_name(int backend) {
+  switch (backend) {
+    case FD_BACKEND_POLL:     return "poll";
+    case FD_BACKEND_EPOLL:    return "epoll";
+    case FD_BACKEND_IO_URING: return "io_uring";
+    default:                  return "threads";
+  }
+}
+
+static int current_fd_backend() {
+  int backend = fd_backend_choice.load();
+  if (backend >= 0)
+    return backend;
+
+  const char* env = std::getenv("LATER_FD_BACKEND");
+  backend = env != NULL ? parse_fd_backend(env) : -1;
+  if (backend < 0) {
+#ifdef LATER_HAVE_EPOLL
+    backend = FD_BACKEND_EPOLL;
+#else
+    backend = FD_BACKEND_POLL;
+#endif
+  }
+  int unset = -1;
+  fd_backend_choice.compare_exchange_strong(unset, backend);
+  return fd_backend_choice.load();
+}
+
+static bool start_wait(std::unique_ptr<ThreadArgs> args) {
+  int backend = current_fd_backend();
+#ifdef LATER_HAVE_LIBURING
+  if (backend == FD_BACKEND_IO_URING && !uringPoller.start()) {
+    // The kernel doesn't support io_uring, or it's disabled. Don't try again.
+    int uring = FD_BACKEND_IO_URING;
+    fd_backend_choice.compare_exchange_strong(uring, FD_BACKEND_EPOLL);
+    backend = FD_BACKEND_EPOLL;
+  }
+#endif
+  args->control->backend = backend;
+  FdPoller* poller = poller_for(backend);
+  if (poller != NULL)
+    return poller->add(args);
+  return start_thread(args);
+}
+
+static void cancel_wait(const std::shared_ptr<FdWaitControl>& control) {
+  FdPoller* poller = poller_for(control->backend);
+  if (poller != NULL) {
+    poller->cancel(control);
+  } else if (control->persistent) {
+    // Don't leave the thread of a persistent watch waiting for a rearm.
+    control->rearm();
+  }
+}
+
+static void rearm_wait(const std::shared_ptr<FdWaitControl>& control) {
+  FdPoller* poller = poller_for(control->backend);
+  if (poller != NULL) {
+    poller->rearm(control);
+  } else {
+    control->rearm();
+  }
+}
+
+#ifndef _WIN32
+// A pidfd for process `pid`, or -1 with errno set. Only Linux (5.3 and later)
+// has pidfds.
+static int open_pidfd(int pid) {
+#if defined(__linux__) && defined(SYS_pidfd_open)
+  return static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+#else
+  (void) pid;
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+static void pid_watcher_after_fork();
+
+// How often the PidWatcher thread checks the processes it's waiting for.
+static const double PID_CHECK_INTERVAL = 0.1;
+
+// Without pidfds, later_pid() waits are all checked by one thread, every
+// PID_CHECK_INTERVAL seconds while there are any. It doesn't handle SIGCHLD,
+// since that would change how the signal is handled for the whole process,
+// and it would miss processes that aren't children of this one anyway. Waits
+// are handed to the thread as in FdPoller, and a cancelled wait is dropped the
+// next time the thread checks.
+class PidWatcher {
+public:
+  PidWatcher() : incoming(nullptr), started(false), wake_fd(-1), wake_write_fd(-1), startMutex(tct_mtx_plain) {}
+
+  // Takes ownership of `args` if it returns true. Can be called from any
+  // thread.
+  bool add(std::unique_ptr<ThreadArgs>& args) {
+    if (!start())
+      return false;
+    Pending* pending = new Pending{std::move(args), incoming.load()};
+    while (!incoming.compare_exchange_weak(pending->next, pending)) {}
+    wake();
+    return true;
+  }
+
+  // In the child after a fork(), the thread is gone. The waits it had are
+  // abandoned, as in FdPoller::afterFork(); the pipe is kept for the next
+  // start().
+  void afterFork() {
+    started = false;
+    for (std::list<std::unique_ptr<ThreadArgs>>::iterator it = waits.begin(); it != waits.end(); ++it) {
+      it->release();
+    }
+    waits.clear();
+    incoming.store(nullptr);
+  }
+
+private:
+  struct Pending {
+    std::unique_ptr<ThreadArgs> args;
+    Pending* next;
+  };
 
-  if (tct_thrd_create(&thr, &wait_thread, static_cast<void *>(args.release())) != tct_thrd_success)
+  bool start() {
+    if (started.load()) {
+      return true;
+    }
+    Guard guard(&startMutex);
+    if (started.load()) {
+      return true;
+    }
+    static int atfork = pthread_atfork(NULL, NULL, pid_watcher_after_fork);
+    (void) atfork;
+
+    if (wake_fd < 0) {
+      int pipe_fds[2];
+      if (pipe(pipe_fds) != 0) {
+        return false;
+      }
+      for (int i = 0; i < 2; i++) {
+        fcntl(pipe_fds[i], F_SETFL, fcntl(pipe_fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(pipe_fds[i], F_SETFD, FD_CLOEXEC);
+      }
+      wake_fd = pipe_fds[0];
+      wake_write_fd = pipe_fds[1];
+    }
+
+    tct_thrd_t thr;
+    if (tct_thrd_create(&thr, &PidWatcher::thread_main, static_cast<void *>(this)) != tct_thrd_success) {
+      return false;
+    }
+    started = true;
+    return true;
+  }
+
+  void wake() {
+    ssize_t res = write(wake_write_fd, "x", 1);
+    (void) res;
+  }
+
+  static int thread_main(void *arg) {
+    tct_thrd_detach(tct_thrd_current());
+    static_cast<PidWatcher *>(arg)->run();
+    return 0;
+  }
+
+  void run() {
+    char buf[64];
+    while (true) {
+      // With no waits, sleep until one is added.
+      int timeout = -1;
+      if (!waits.empty()) {
+        double waitFor = PID_CHECK_INTERVAL;
+        Timestamp now;
+        for (std::list<std::unique_ptr<ThreadArgs>>::iterator it = waits.begin(); it != waits.end(); ++it) {
+          waitFor = std::fmin(waitFor, std::fmax((*it)->timeout.diff_secs(now), 0));
+        }
+        timeout = static_cast<int>(std::ceil(waitFor * 1000));
+      }
+      struct pollfd pfd;
+      pfd.fd = wake_fd;
+      pfd.events = POLLIN;
+      pfd.revents = 0;
+      poll(&pfd, 1, timeout);
+      while (read(wake_fd, buf, sizeof(buf)) > 0) {}
+
+      Pending* pending = incoming.exchange(nullptr);
+      while (pending != nullptr) {
+        waits.push_back(std::move(pending->args));
+        Pending* next = pending->next;
+        delete pending;
+        pending = next;
+      }
+
+      Timestamp now;
+      for (std::list<std::unique_ptr<ThreadArgs>>::iterator it = waits.begin(); it != waits.end();) {
+        ThreadArgs* args = it->get();
+        if (!args->control->isActive()) {
+          it = waits.erase(it);
+          continue;
+        }
+        if (pid_exited(args->pid, &args->exitStatus)) {
+          args->exited = true;
+        } else if (now < args->timeout) {
+          ++it;
+          continue;
+        }
+        deliver(std::move(*it));
+        it = waits.erase(it);
+      }
+    }
+  }
+
+  std::atomic<Pending*> incoming;
+  std::atomic<bool> started;
+  int wake_fd;
+  int wake_write_fd;
+  Mutex startMutex;
+  // Only used by the thread.
+  std::list<std::unique_ptr<ThreadArgs>> waits;
+};
+
+static PidWatcher pidWatcher;
+
+static void pid_watcher_after_fork() {
+  pidWatcher.afterFork();
+}
+#endif
+
+static SEXP execLater_fd_impl(const Rcpp::Function& callback, int num_fds, struct pollfd *fds, double timeout, int loop_id,
+                              bool persistent, bool revents, int readMax = 0) {
+
+  std::unique_ptr<ThreadArgs> args(new ThreadArgs(callback, num_fds, fds, timeout, loop_id, callbackRegistryTable, persistent, revents));
+  args->readMax = readMax;
+  std::shared_ptr<FdWaitControl> control = args->control;
+
+  if (!start_wait(std::move(args)))
     Rcpp::stop("Thread creation failed");
 
-  Rcpp::XPtr<std::shared_ptr<std::atomic<bool>>> xptr(new std::shared_ptr<std::atomic<bool>>(active), true);
+  Rcpp::XPtr<std::shared_ptr<FdWaitControl>> xptr(new std::shared_ptr<FdWaitControl>(control), true);
   return xptr;
 
 }
 
 // native version
-static int execLater_fd_native(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, double timeout, int loop_id) {
+static int execLater_fd_native(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, double timeout, int loop_id,
+                               int flags) {
 
-  std::unique_ptr<ThreadArgs> args(new ThreadArgs(func, data, num_fds, fds, timeout, loop_id, callbackRegistryTable));
-  tct_thrd_t thr;
+  std::unique_ptr<ThreadArgs> args(new ThreadArgs(func, data, num_fds, fds, timeout, loop_id, callbackRegistryTable,
+                                                  false, flags & LATER_FD_REVENTS));
 
-  return tct_thrd_create(&thr, &wait_thread, static_cast<void *>(args.release())) != tct_thrd_success;
+  return !start_wait(std::move(args));
 
 }
 
-// [[Rcpp::export(rng = false)]]
-Rcpp::RObject execLater_fd(Rcpp::Function callback, Rcpp::IntegerVector readfds, Rcpp::IntegerVector writefds,
-                           Rcpp::IntegerVector exceptfds, Rcpp::NumericVector timeoutSecs, Rcpp::IntegerVector loop_id) {
+static int execLater_read_native(void (*func)(const char *, int, void *), void *data, int fd, int max_bytes, double timeout, int loop_id) {
+
+  if (max_bytes <= 0)
+    return 1;
+
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  std::unique_ptr<ThreadArgs> args;
+  try {
+    args.reset(new ThreadArgs(func, data, &pfd, max_bytes, timeout, loop_id, callbackRegistryTable));
+  } catch (std::runtime_error&) {
+    // The loop doesn't exist.
+    return 1;
+  }
+
+  return !start_wait(std::move(args));
+
+}
+
+// The persistent watches started from C, by ID, so that they can be cancelled
+// with execLaterFdUnwatchNative().
+static Mutex nativeWatchesMutex(tct_mtx_plain);
+static uint64_t nextNativeWatchId = 1;
+static std::map<uint64_t, std::shared_ptr<FdWaitControl>> nativeWatches;
+
+static uint64_t execLater_fd_watch_native(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, int loop_id,
+                                          int flags) {
+
+  if (num_fds <= 0)
+    return 0;
+
+  std::unique_ptr<ThreadArgs> args;
+  try {
+    args.reset(new ThreadArgs(func, data, num_fds, fds, R_PosInf, loop_id, callbackRegistryTable, true, flags & LATER_FD_REVENTS));
+  } catch (std::runtime_error&) {
+    // The loop doesn't exist.
+    return 0;
+  }
+  std::shared_ptr<FdWaitControl> control = args->control;
+
+  if (!start_wait(std::move(args)))
+    return 0;
+
+  Guard guard(&nativeWatchesMutex);
+  uint64_t id = nextNativeWatchId++;
+  nativeWatches[id] = control;
+  return id;
+
+}
+
+#ifdef __linux__
+// What a later_file() change record says happened to a path.
+enum FileChange {
+  FILE_CREATED = 1,
+  FILE_MODIFIED = 2,
+  FILE_DELETED = 4
+};
+
+static const uint32_t FILE_WATCH_EVENTS = IN_CREATE | IN_MOVED_TO | IN_MODIFY | IN_ATTRIB | IN_DELETE | IN_MOVED_FROM |
+                                          IN_DELETE_SELF | IN_MOVE_SELF;
+
+// A later_file() watch. Its inotify instance is watched like a
+// later_fd_watch(), on the same poller, and read on the main thread whenever
+// it's readable. The changes are merged by path, and the R function is called
+// with all of them `window` seconds after the first, so a burst of events is
+// a single call with one record per path. Main thread only.
+class FileWatch {
+public:
+  FileWatch(uint64_t id, const Rcpp::Function& callback, double window, int loop)
+    : id(id), callback(new Rcpp::Function(callback)), window(window), loop(loop), inotifyFd(-1), overflowed(false),
+      timerId(0) {}
+
+  // Read and merge all the events there are, and schedule the delivery of
+  // the changes if it isn't scheduled already.
+  void readEvents();
+  // The changes as a list of columns (path, created, modified, deleted), in
+  // the order the paths were first changed. This starts a new batch.
+  Rcpp::List takeChanges();
+  bool cancel();
+
+  const uint64_t id;
+  std::unique_ptr<Rcpp::Function> callback;
+  const double window;
+  const int loop;
+  // Owned by the wait in `control`.
+  int inotifyFd;
+  std::shared_ptr<FdWaitControl> control;
+  // The watched paths, by watch descriptor.
+  std::unordered_map<int, std::string> paths;
+
+private:
+  void addEvent(const struct inotify_event* event);
+
+  std::vector<std::pair<std::string, int>> changes;
+  std::unordered_map<std::string, std::size_t> changeIndex;
+  // Whether events were lost because the kernel's queue overflowed.
+  bool overflowed;
+  uint64_t timerId;
+};
+
+// The active later_file() watches. Callbacks refer to them by ID, so one that
+// fires after its watch is cancelled finds nothing to do.
+static uint64_t nextFileWatchId = 1;
+static std::map<uint64_t, std::shared_ptr<FileWatch>> fileWatches;
+
+static std::shared_ptr<FileWatch> find_file_watch(uint64_t id) {
+  std::map<uint64_t, std::shared_ptr<FileWatch>>::iterator it = fileWatches.find(id);
+  if (it == fileWatches.end())
+    return std::shared_ptr<FileWatch>();
+  return it->second;
+}
+
+static void file_watch_deliver(void *arg) {
+
+  ASSERT_MAIN_THREAD()
+
+  // A copy, because the callback may cancel the watch.
+  std::shared_ptr<FileWatch> watch = find_file_watch(reinterpret_cast<uintptr_t>(arg));
+  if (!watch)
+    return;
+
+  Rcpp::List changes = watch->takeChanges();
+  Rcpp::Function callback = *watch->callback;
+  callback(changes);
+
+}
+
+void FileWatch::readEvents() {
+
+  alignas(struct inotify_event) char buffer[4096];
+  for (;;) {
+    ssize_t n = read(inotifyFd, buffer, sizeof(buffer));
+    if (n < 0 && errno == EINTR)
+      continue;
+    // Until EAGAIN: there are no more events for now.
+    if (n <= 0)
+      break;
+    for (char* p = buffer; p < buffer + n; ) {
+      const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+      p += sizeof(struct inotify_event) + event->len;
+      addEvent(event);
+    }
+  }
+
+  if ((changes.empty() && !overflowed) || timerId != 0)
+    return;
+  timerId = callbackRegistryTable.scheduleCallback(file_watch_deliver, reinterpret_cast<void *>(static_cast<uintptr_t>(id)),
+                                                   window, loop);
+
+}
+
+void FileWatch::addEvent(const struct inotify_event* event) {
+
+  if (event->mask & IN_Q_OVERFLOW) {
+    overflowed = true;
+    return;
+  }
+
+  std::unordered_map<int, std::string>::iterator it = paths.find(event->wd);
+  if (it == paths.end())
+    return;
+  if (event->mask & IN_IGNORED) {
+    // The path isn't watched any more.
+    paths.erase(it);
+    return;
+  }
+
+  int change = 0;
+  if (event->mask & (IN_CREATE | IN_MOVED_TO))
+    change |= FILE_CREATED;
+  if (event->mask & (IN_MODIFY | IN_ATTRIB))
+    change |= FILE_MODIFIED;
+  if (event->mask & (IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF))
+    change |= FILE_DELETED;
+  if (change == 0)
+    return;
+
+  // A watch follows the file, not the path, so stop watching a path that's
+  // moved away. Its IN_IGNORED comes later.
+  if (event->mask & IN_MOVE_SELF)
+    inotify_rm_watch(inotifyFd, event->wd);
+
+  std::string path = it->second;
+  if (event->len > 0) {
+    // A file in a watched directory. The name is padded with NULs.
+    if (path.empty() || path[path.size() - 1] != '/')
+      path += '/';
+    path += event->name;
+  }
+
+  std::unordered_map<std::string, std::size_t>::iterator found = changeIndex.find(path);
+  if (found == changeIndex.end()) {
+    changeIndex[path] = changes.size();
+    changes.push_back(std::make_pair(path, change));
+  } else {
+    changes[found->second].second |= change;
+  }
+
+}
+
+Rcpp::List FileWatch::takeChanges() {
+
+  const int n = static_cast<int>(changes.size()) + (overflowed ? 1 : 0);
+  Rcpp::CharacterVector path(n);
+  Rcpp::LogicalVector created(n), modified(n), deleted(n);
+  for (std::size_t i = 0; i < changes.size(); i++) {
+    path[i] = changes[i].first;
+    created[i] = (changes[i].second & FILE_CREATED) != 0;
+    modified[i] = (changes[i].second & FILE_MODIFIED) != 0;
+    deleted[i] = (changes[i].second & FILE_DELETED) != 0;
+  }
+  if (overflowed) {
+    // Some changes were lost, so nothing is known about them.
+    path[n - 1] = NA_STRING;
+    created[n - 1] = modified[n - 1] = deleted[n - 1] = NA_LOGICAL;
+  }
+
+  changes.clear();
+  changeIndex.clear();
+  overflowed = false;
+  timerId = 0;
+
+  return Rcpp::List::create(
+    Rcpp::_["path"] = path,
+    Rcpp::_["created"] = created,
+    Rcpp::_["modified"] = modified,
+    Rcpp::_["deleted"] = deleted
+  );
+
+}
+
+bool FileWatch::cancel() {
+
+  std::map<uint64_t, std::shared_ptr<FileWatch>>::iterator it = fileWatches.find(id);
+  if (it == fileWatches.end())
+    return false;
+
+  if (timerId != 0) {
+    std::shared_ptr<CallbackRegistry> registry = callbackRegistryTable.getRegistry(loop);
+    if (registry != nullptr)
+      registry->cancel(timerId);
+    timerId = 0;
+  }
+  // Release the R function now, and tell the waiting thread to stop. It
+  // closes the inotify instance once it's done with it.
+  callback.reset();
+  if (control->deactivate())
+    cancel_wait(control);
+
+  fileWatches.erase(it);
+  return true;
+
+}
+#endif
+
+static std::vector<struct pollfd> make_pollfds(Rcpp::IntegerVector readfds, Rcpp::IntegerVector writefds,
+                                               Rcpp::IntegerVector exceptfds) {
 
   const int rfds = static_cast<int>(readfds.size());
   const int wfds = static_cast<int>(writefds.size());
   const int efds = static_cast<int>(exceptfds.size());
-  const int num_fds = rfds + wfds + efds;
-  const double timeout = num_fds ? timeoutSecs[0] : 0;
-  const int loop = loop_id[0];
 
   std::vector<struct pollfd> pollfds;
-  pollfds.reserve(num_fds);
+  pollfds.reserve(rfds + wfds + efds);
   struct pollfd pfd;
 
   for (int i = 0; i < rfds; i++) {
@@ -191,25 +1942,194 @@ Rcpp::RObject execLater_fd(Rcpp::Function callback, Rcpp::IntegerVector readfds,
     pollfds.push_back(pfd);
   }
 
-  return execLater_fd_impl(callback, num_fds, pollfds.data(), timeout, loop);
+  return pollfds;
+
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::RObject execLater_fd(Rcpp::Function callback, Rcpp::IntegerVector readfds, Rcpp::IntegerVector writefds,
+                           Rcpp::IntegerVector exceptfds, Rcpp::NumericVector timeoutSecs, Rcpp::IntegerVector loop_id,
+                           bool revents) {
+
+  std::vector<struct pollfd> pollfds = make_pollfds(readfds, writefds, exceptfds);
+  const int num_fds = static_cast<int>(pollfds.size());
+  const double timeout = num_fds ? timeoutSecs[0] : 0;
+  const int loop = loop_id[0];
+
+  return execLater_fd_impl(callback, num_fds, pollfds.data(), timeout, loop, false, revents);
+
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::RObject execLater_fd_watch(Rcpp::Function callback, Rcpp::IntegerVector readfds, Rcpp::IntegerVector writefds,
+                                 Rcpp::IntegerVector exceptfds, Rcpp::IntegerVector loop_id, bool revents) {
+
+  std::vector<struct pollfd> pollfds = make_pollfds(readfds, writefds, exceptfds);
+  const int num_fds = static_cast<int>(pollfds.size());
+  if (num_fds == 0)
+    Rcpp::stop("At least one file descriptor must be supplied");
+
+  return execLater_fd_impl(callback, num_fds, pollfds.data(), R_PosInf, loop_id[0], true, revents);
+
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::RObject execLater_read(Rcpp::Function callback, int fd, int n, double timeoutSecs, int loop_id) {
+
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  return execLater_fd_impl(callback, 1, &pfd, timeoutSecs, loop_id, false, false, n);
+
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::RObject execLater_pid(Rcpp::Function callback, int pid, double timeoutSecs, int loop_id) {
+
+#ifdef _WIN32
+  Rcpp::stop("later_pid() is not supported on Windows");
+#else
+  int pidfd = open_pidfd(pid);
+  int pidfd_errno = errno;
+  struct pollfd pfd;
+  pfd.fd = pidfd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  std::unique_ptr<ThreadArgs> args;
+  try {
+    args.reset(new ThreadArgs(callback, pidfd >= 0 ? 1 : 0, &pfd, timeoutSecs, loop_id, callbackRegistryTable));
+  } catch (...) {
+    if (pidfd >= 0)
+      close(pidfd);
+    throw;
+  }
+  args->pid = pid;
+  args->ownedFd = pidfd;
+  std::shared_ptr<FdWaitControl> control = args->control;
+
+  bool started;
+  if (pidfd >= 0) {
+    started = start_wait(std::move(args));
+  } else if (pidfd_errno == ESRCH) {
+    // The process is gone, and its status with it.
+    args->exited = true;
+    deliver(std::move(args));
+    started = true;
+  } else {
+    started = pidWatcher.add(args);
+  }
+  if (!started)
+    Rcpp::stop("Thread creation failed");
+
+  Rcpp::XPtr<std::shared_ptr<FdWaitControl>> xptr(new std::shared_ptr<FdWaitControl>(control), true);
+  return xptr;
+#endif
+
+}
+
+// [[Rcpp::export(rng = false)]]
+Rcpp::RObject execLater_file(Rcpp::Function callback, std::vector<std::string> paths, double window, int loop_id) {
+
+#ifndef __linux__
+  Rcpp::stop("later_file() is only supported on Linux");
+#else
+  std::shared_ptr<FileWatch> watch = std::make_shared<FileWatch>(nextFileWatchId, callback, window, loop_id);
+
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0)
+    Rcpp::stop(std::string("Can't watch files: ") + strerror(errno));
+  for (std::size_t i = 0; i < paths.size(); i++) {
+    const std::string& path = paths[i];
+    int wd = inotify_add_watch(fd, path.c_str(), FILE_WATCH_EVENTS);
+    if (wd < 0) {
+      int err = errno;
+      close(fd);
+      Rcpp::stop("Can't watch " + path + ": " + strerror(err));
+    }
+    watch->paths[wd] = path;
+  }
+  watch->inotifyFd = fd;
+
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  std::unique_ptr<ThreadArgs> args;
+  try {
+    args.reset(new ThreadArgs(1, &pfd, R_PosInf, loop_id, callbackRegistryTable, true));
+  } catch (...) {
+    close(fd);
+    throw;
+  }
+  args->ownedFd = fd;
+  const uint64_t id = nextFileWatchId++;
+  args->control->callback_native = [id](int *) {
+    std::shared_ptr<FileWatch> watch = find_file_watch(id);
+    if (watch)
+      watch->readEvents();
+  };
+  watch->control = args->control;
+
+  fileWatches[id] = watch;
+  if (!start_wait(std::move(args))) {
+    fileWatches.erase(id);
+    Rcpp::stop("Thread creation failed");
+  }
+
+  Rcpp::XPtr<std::shared_ptr<FileWatch>> xptr(new std::shared_ptr<FileWatch>(watch), true);
+  return xptr;
+#endif
 
 }
 
 // [[Rcpp::export(rng = false)]]
 Rcpp::LogicalVector fd_cancel(Rcpp::RObject xptr) {
 
-  Rcpp::XPtr<std::shared_ptr<std::atomic<bool>>> active(xptr);
+  Rcpp::XPtr<std::shared_ptr<FdWaitControl>> control(xptr);
 
-  bool cancelled = true;
-  // atomic compare_exchange_strong:
-  // if *active is true, *active is changed to false (successful cancel)
-  // if *active is false (already run or cancelled), cancelled is changed to false
-  (*active)->compare_exchange_strong(cancelled, false);
+  if (!(*control)->deactivate())
+    return false;
 
-  return cancelled;
+  // Release the R function now, and tell the waiting thread to stop.
+  (*control)->callback.reset();
+  cancel_wait(*control);
+
+  return true;
 
 }
 
+// [[Rcpp::export(rng = false)]]
+Rcpp::LogicalVector file_cancel(Rcpp::RObject xptr) {
+
+#ifndef __linux__
+  return false;
+#else
+  Rcpp::XPtr<std::shared_ptr<FileWatch>> watch(xptr);
+  return (*watch)->cancel();
+#endif
+
+}
+
+// Sets the backend used by later_fd() waits started from now on, and returns
+// the previous one. Used to compare them in tests and benchmarks.
+// [[Rcpp::export(rng = false)]]
+std::string fd_backend(std::string backend) {
+  int old_backend = current_fd_backend();
+
+  if (backend != "") {
+    int new_backend = parse_fd_backend(backend);
+    if (new_backend < 0)
+      Rcpp::stop("Unknown or unavailable value for `backend`");
+    fd_backend_choice = new_backend;
+  }
+
+  return fd_backend_name(old_backend);
+}
+
 // Schedules a C function that takes a pointer to an integer array (provided by
 // this function when calling back) and a void * argument, to execute on file
 // descriptor readiness. Returns 0 upon success and 1 if creating the wait
@@ -217,5 +2137,52 @@ Rcpp::LogicalVector fd_cancel(Rcpp::RObject xptr) {
 // on failure.
 extern "C" int execLaterFdNative(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, double timeoutSecs, int loop_id) {
   ensureInitialized();
-  return execLater_fd_native(func, data, num_fds, fds, timeoutSecs, loop_id);
+  return execLater_fd_native(func, data, num_fds, fds, timeoutSecs, loop_id, 0);
+}
+
+// Like execLaterFdNative(), with `flags`. With LATER_FD_REVENTS, the C function
+// is called on the raw revents of each file descriptor instead of 1/0/NA.
+extern "C" int execLaterFdNative2(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, double timeoutSecs, int loop_id, int flags) {
+  ensureInitialized();
+  return execLater_fd_native(func, data, num_fds, fds, timeoutSecs, loop_id, flags);
+}
+
+// Like execLaterFdNative(), but the C function is called every time any of the
+// file descriptors is ready, until the watch is cancelled with
+// execLaterFdUnwatchNative(). `flags` are as for execLaterFdNative2(). Returns
+// the ID of the watch, or 0 on failure.
+extern "C" uint64_t execLaterFdWatchNative(void (*func)(int *, void *), void *data, int num_fds, struct pollfd *fds, int loop_id, int flags) {
+  ensureInitialized();
+  return execLater_fd_watch_native(func, data, num_fds, fds, loop_id, flags);
+}
+
+// Schedules a C function to be called with the bytes read from `fd`, once it's
+// readable. The read is done on the waiting thread, and reads at most
+// `max_bytes`. The function is called with a pointer to the bytes, which is
+// only valid during the call, and the number of bytes read, which is 0 at end
+// of file, -ETIMEDOUT if the wait timed out, or a negative errno if the read
+// failed. Returns 0 upon success and 1 on failure, as execLaterFdNative().
+extern "C" int execLaterReadNative(void (*func)(const char *, int, void *), void *data, int fd, int max_bytes, double timeoutSecs, int loop_id) {
+  ensureInitialized();
+  return execLater_read_native(func, data, fd, max_bytes, timeoutSecs, loop_id);
+}
+
+// Cancels a watch started with execLaterFdWatchNative(). Must be called from
+// the main thread. Returns 1 if the watch was cancelled and 0 if the ID is
+// unknown or has been cancelled already.
+extern "C" int execLaterFdUnwatchNative(uint64_t id) {
+  ASSERT_MAIN_THREAD()
+  std::shared_ptr<FdWaitControl> control;
+  {
+    Guard guard(&nativeWatchesMutex);
+    std::map<uint64_t, std::shared_ptr<FdWaitControl>>::iterator it = nativeWatches.find(id);
+    if (it == nativeWatches.end())
+      return 0;
+    control = it->second;
+    nativeWatches.erase(it);
+  }
+  if (!control->deactivate())
+    return 0;
+  cancel_wait(control);
+  return 1;
 }
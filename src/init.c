@@ -12,14 +12,27 @@ Check these declarations against the C/Fortran source code.
 /* .Call calls */
 SEXP _later_ensureInitialized(void);
 SEXP _later_execCallbacks(SEXP, SEXP, SEXP);
+SEXP _later_execCallbacksBudget(SEXP, SEXP, SEXP, SEXP, SEXP);
+SEXP _later_callbackPoolStats(SEXP);
+SEXP _later_setLoopSlack(SEXP, SEXP);
+SEXP _later_autorunnerStats(void);
 SEXP _later_idle(SEXP);
 SEXP _later_execLater(SEXP, SEXP, SEXP);
+SEXP _later_execLaterEvery(SEXP, SEXP, SEXP, SEXP, SEXP);
+SEXP _later_execLaterMany(SEXP, SEXP, SEXP);
 SEXP _later_cancel(SEXP, SEXP);
-SEXP _later_execLater_fd(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+SEXP _later_cancelMany(SEXP, SEXP);
+SEXP _later_execLater_fd(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+SEXP _later_execLater_fd_watch(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+SEXP _later_execLater_read(SEXP, SEXP, SEXP, SEXP, SEXP);
+SEXP _later_execLater_pid(SEXP, SEXP, SEXP, SEXP);
+SEXP _later_execLater_file(SEXP, SEXP, SEXP, SEXP);
 SEXP _later_fd_cancel(SEXP);
+SEXP _later_file_cancel(SEXP);
+SEXP _later_fd_backend(SEXP);
 SEXP _later_nextOpSecs(SEXP);
 SEXP _later_testCallbackOrdering(void);
-SEXP _later_createCallbackRegistry(SEXP, SEXP);
+SEXP _later_createCallbackRegistry(SEXP, SEXP, SEXP);
 SEXP _later_deleteCallbackRegistry(SEXP);
 SEXP _later_existsCallbackRegistry(SEXP);
 SEXP _later_notifyRRefDeleted(SEXP);
@@ -34,14 +47,27 @@ SEXP _later_wref_key(SEXP);
 static const R_CallMethodDef CallEntries[] = {
   {"_later_ensureInitialized",      (DL_FUNC) &_later_ensureInitialized,      0},
   {"_later_execCallbacks",          (DL_FUNC) &_later_execCallbacks,          3},
+  {"_later_execCallbacksBudget",    (DL_FUNC) &_later_execCallbacksBudget,    5},
+  {"_later_callbackPoolStats",      (DL_FUNC) &_later_callbackPoolStats,      1},
+  {"_later_setLoopSlack",           (DL_FUNC) &_later_setLoopSlack,           2},
+  {"_later_autorunnerStats",        (DL_FUNC) &_later_autorunnerStats,        0},
   {"_later_idle",                   (DL_FUNC) &_later_idle,                   1},
   {"_later_execLater",              (DL_FUNC) &_later_execLater,              3},
+  {"_later_execLaterEvery",         (DL_FUNC) &_later_execLaterEvery,         5},
+  {"_later_execLaterMany",          (DL_FUNC) &_later_execLaterMany,          3},
   {"_later_cancel",                 (DL_FUNC) &_later_cancel,                 2},
-  {"_later_execLater_fd",           (DL_FUNC) &_later_execLater_fd,           6},
+  {"_later_cancelMany",             (DL_FUNC) &_later_cancelMany,             2},
+  {"_later_execLater_fd",           (DL_FUNC) &_later_execLater_fd,           7},
+  {"_later_execLater_fd_watch",     (DL_FUNC) &_later_execLater_fd_watch,     6},
+  {"_later_execLater_read",         (DL_FUNC) &_later_execLater_read,         5},
+  {"_later_execLater_pid",          (DL_FUNC) &_later_execLater_pid,          4},
+  {"_later_execLater_file",         (DL_FUNC) &_later_execLater_file,         4},
   {"_later_fd_cancel",              (DL_FUNC) &_later_fd_cancel,              1},
+  {"_later_file_cancel",            (DL_FUNC) &_later_file_cancel,            1},
+  {"_later_fd_backend",             (DL_FUNC) &_later_fd_backend,             1},
   {"_later_nextOpSecs",             (DL_FUNC) &_later_nextOpSecs,             1},
   {"_later_testCallbackOrdering",   (DL_FUNC) &_later_testCallbackOrdering,   0},
-  {"_later_createCallbackRegistry", (DL_FUNC) &_later_createCallbackRegistry, 2},
+  {"_later_createCallbackRegistry", (DL_FUNC) &_later_createCallbackRegistry, 3},
   {"_later_deleteCallbackRegistry", (DL_FUNC) &_later_deleteCallbackRegistry, 1},
   {"_later_existsCallbackRegistry", (DL_FUNC) &_later_existsCallbackRegistry, 1},
   {"_later_notifyRRefDeleted",      (DL_FUNC) &_later_notifyRRefDeleted,      1},
@@ -57,6 +83,14 @@ static const R_CallMethodDef CallEntries[] = {
 
 uint64_t execLaterNative2(void (*)(void*), void*, double, int);
 int execLaterFdNative(void (*)(int *, void *), void *, int, struct pollfd *, double, int);
+int execLaterFdNative2(void (*)(int *, void *), void *, int, struct pollfd *, double, int, int);
+uint64_t execLaterFdWatchNative(void (*)(int *, void *), void *, int, struct pollfd *, int, int);
+int execLaterFdUnwatchNative(uint64_t);
+int execLaterReadNative(void (*)(const char *, int, void *), void *, int, int, double, int);
+struct later_batch_item;
+int execLaterBatchNative(const struct later_batch_item *, int, uint64_t *, int);
+uint64_t execLaterEveryNative(void (*)(void*), void*, double, double, int, int);
+int execLaterCancelNative(uint64_t, int);
 int apiVersion(void);
 
 void R_init_later(DllInfo *dll) {
@@ -65,5 +99,12 @@ void R_init_later(DllInfo *dll) {
   R_forceSymbols(dll, TRUE);
   R_RegisterCCallable("later", "execLaterNative2", (DL_FUNC)&execLaterNative2);
   R_RegisterCCallable("later", "execLaterFdNative",(DL_FUNC)&execLaterFdNative);
+  R_RegisterCCallable("later", "execLaterFdNative2", (DL_FUNC)&execLaterFdNative2);
+  R_RegisterCCallable("later", "execLaterBatchNative", (DL_FUNC)&execLaterBatchNative);
+  R_RegisterCCallable("later", "execLaterEveryNative", (DL_FUNC)&execLaterEveryNative);
+  R_RegisterCCallable("later", "execLaterCancelNative", (DL_FUNC)&execLaterCancelNative);
+  R_RegisterCCallable("later", "execLaterFdWatchNative", (DL_FUNC)&execLaterFdWatchNative);
+  R_RegisterCCallable("later", "execLaterFdUnwatchNative", (DL_FUNC)&execLaterFdUnwatchNative);
+  R_RegisterCCallable("later", "execLaterReadNative", (DL_FUNC)&execLaterReadNative);
   R_RegisterCCallable("later", "apiVersion",       (DL_FUNC)&apiVersion);
 }
@@ -8,6 +8,7 @@
 
 #include "callback_registry.h"
 #include "callback_registry_table.h"
+#include "callback_pool.h"
 
 #include "interrupt.h"
 
@@ -160,9 +161,9 @@ bool notifyRRefDeleted(int loop_id) {
 
 
 // [[Rcpp::export(rng = false)]]
-void createCallbackRegistry(int id, int parent_id) {
+void createCallbackRegistry(int id, int parent_id, std::string queue_type) {
   ASSERT_MAIN_THREAD()
-  callbackRegistryTable.create(id, parent_id);
+  callbackRegistryTable.create(id, parent_id, queueTypeFromString(queue_type));
 }
 
 // [[Rcpp::export(rng = false)]]
@@ -182,11 +183,133 @@ Rcpp::List list_queue_(int id) {
 }
 
 
+// Counters from the loop's callback memory pool, for benchmarking.
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector callbackPoolStats(int loop_id) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<CallbackRegistry> registry = callbackRegistryTable.getRegistry(loop_id);
+  if (registry == nullptr) {
+    Rcpp::stop("CallbackRegistry does not exist.");
+  }
+  CallbackPoolStats stats = registry->getPool()->stats();
+  return Rcpp::NumericVector::create(
+    Rcpp::_["allocations"]      = (double)stats.allocations,
+    Rcpp::_["deallocations"]    = (double)stats.deallocations,
+    Rcpp::_["heap_allocations"] = (double)stats.heapAllocations
+  );
+}
+
+
+// Set the slack for a loop, and return the old value.
+// [[Rcpp::export(rng = false)]]
+double setLoopSlack(int loop_id, double secs) {
+  ASSERT_MAIN_THREAD()
+  shared_ptr<CallbackRegistry> registry = callbackRegistryTable.getRegistry(loop_id);
+  if (registry == nullptr) {
+    Rcpp::stop("CallbackRegistry does not exist.");
+  }
+  double old = registry->getSlack();
+  registry->setSlack(secs);
+  return old;
+}
+
+// Counters from the mechanism that runs the global loop when the console is
+// idle, for benchmarking.
+// [[Rcpp::export(rng = false)]]
+Rcpp::NumericVector autorunnerStats() {
+  uint64_t wakeups, handlerCalls, timerArms;
+  getAutorunnerCounts(wakeups, handlerCalls, timerArms);
+  return Rcpp::NumericVector::create(
+    Rcpp::_["wakeups"]       = (double)wakeups,
+    Rcpp::_["handler_calls"] = (double)handlerCalls,
+    Rcpp::_["timer_arms"]    = (double)timerArms
+  );
+}
+
+
+// ============================================================================
+// ExecBudget
+// ============================================================================
+
+ExecBudget::ExecBudget()
+  : secs(R_PosInf), maxCallbacks(0), started(false), exhausted(false), count(0)
+{
+}
+
+ExecBudget::ExecBudget(double secs, size_t maxCallbacks)
+  : secs(secs), maxCallbacks(maxCallbacks), started(false), exhausted(false), count(0)
+{
+}
+
+void ExecBudget::begin() {
+  if (started) {
+    return;
+  }
+  started = true;
+  start = Timestamp();
+  if (R_finite(secs)) {
+    deadline = Timestamp(secs);
+  }
+}
+
+void ExecBudget::charge() {
+  count++;
+}
+
+bool ExecBudget::spent() {
+  if (!exhausted && count > 0) {
+    if (maxCallbacks != 0 && count >= maxCallbacks) {
+      exhausted = true;
+    } else if (deadline.has_value() && !(*deadline > Timestamp())) {
+      exhausted = true;
+    }
+  }
+  return exhausted;
+}
+
+size_t ExecBudget::callbacks() const {
+  return count;
+}
+
+double ExecBudget::elapsed() const {
+  if (!started) {
+    return 0;
+  }
+  return Timestamp().diff_secs(start);
+}
+
+
+// Puts a repeating callback back in its registry after it runs, whether or not
+// it throws an error.
+class RescheduleOnExit {
+public:
+  RescheduleOnExit(const shared_ptr<CallbackRegistry>& registry, const Callback_sp& callback)
+    : registry(registry), callback(callback) {
+  }
+  ~RescheduleOnExit() {
+    if (callback->interval <= 0) {
+      return;
+    }
+    // Only the global loop's tree is run by the autorunner, and it only
+    // needs to know if the callback is now the earliest thing in it.
+    WakeChange change;
+    registry->reschedule(callback, &change);
+    if (change.rootId == GLOBAL_LOOP) {
+      signalAutorunner(*change.wake);
+    }
+  }
+
+private:
+  const shared_ptr<CallbackRegistry>& registry;
+  const Callback_sp& callback;
+};
+
 // Execute callbacks for a single event loop.
 bool execCallbacksOne(
   bool runAll,
   shared_ptr<CallbackRegistry> callback_registry,
-  Timestamp now
+  Timestamp now,
+  ExecBudget& budget
 ) {
   ASSERT_MAIN_THREAD()
   // execCallbacks can be called directly from C code, and the callbacks may
@@ -198,17 +321,20 @@ bool execCallbacksOne(
   CurrentRegistryGuard current_registry_guard(callback_registry->getId());
 
   do {
-    // We only take one at a time, because we don't want to lose callbacks if
-    // one of the callbacks throws an error
+    // pop() takes all of the due callbacks from the registry at once, but
+    // hands them to us one at a time. If one of them throws an error, the
+    // rest stay in the registry, so they aren't lost.
     Callback_sp callback = callback_registry->pop(now);
     if (callback == nullptr) {
       break;
     }
 
+    budget.charge();
+    RescheduleOnExit reschedule(callback_registry, callback);
     // This line may throw errors!
     callback->invoke();
 
-  } while (runAll);
+  } while (runAll && !budget.spent());
 
   // I think there's no need to lock this since it's only modified from the
   // main thread. But need to check.
@@ -217,7 +343,15 @@ bool execCallbacksOne(
        it != children.end();
        ++it)
   {
-    execCallbacksOne(true, *it, now);
+    if (budget.spent()) {
+      break;
+    }
+    // Skip child subtrees with nothing to do. This is cheap, because each
+    // registry keeps track of the earliest timestamp in its subtree.
+    if (!(*it)->due(now)) {
+      continue;
+    }
+    execCallbacksOne(true, *it, now, budget);
   }
 
   return true;
@@ -226,6 +360,11 @@ bool execCallbacksOne(
 // Execute callbacks for an event loop and its children.
 // [[Rcpp::export(rng = false)]]
 bool execCallbacks(double timeoutSecs, bool runAll, int loop_id) {
+  ExecBudget budget;
+  return execCallbacks(timeoutSecs, runAll, loop_id, budget);
+}
+
+bool execCallbacks(double timeoutSecs, bool runAll, int loop_id, ExecBudget& budget) {
   ASSERT_MAIN_THREAD()
   shared_ptr<CallbackRegistry> registry = callbackRegistryTable.getRegistry(loop_id);
   if (registry == nullptr) {
@@ -236,8 +375,26 @@ bool execCallbacks(double timeoutSecs, bool runAll, int loop_id) {
     return false;
   }
 
+  budget.begin();
   Timestamp now;
-  execCallbacksOne(runAll, registry, now);
+  execCallbacksOne(runAll, registry, now, budget);
+
+  // If the budget ran out before everything that's due was run, make sure
+  // that the rest isn't left waiting until something else wakes up the loop.
+  // Only the global loop and the loops under it are run by the autorunner, so
+  // there's nothing to do for other private loops.
+  if (budget.spent()) {
+    shared_ptr<CallbackRegistry> root = registry;
+    while (root->parent != nullptr) {
+      root = root->parent;
+    }
+    if (root->getId() == GLOBAL_LOOP) {
+      Optional<Timestamp> next = registry->nextWakeTime();
+      if (next.has_value()) {
+        signalAutorunner(*next);
+      }
+    }
+  }
 
   // Call this now, in case any CallbackRegistries which have no R references
   // have emptied.
@@ -245,6 +402,31 @@ bool execCallbacks(double timeoutSecs, bool runAll, int loop_id) {
   return true;
 }
 
+// Like execCallbacks(), but stops after `budgetSecs` seconds or
+// `maxCallbacks` callbacks, and also reports how many callbacks were run and
+// how long they took.
+// [[Rcpp::export(rng = false)]]
+Rcpp::List execCallbacksBudget(double timeoutSecs, bool runAll, int loop_id,
+                               double budgetSecs, double maxCallbacks)
+{
+  ExecBudget budget(budgetSecs, R_finite(maxCallbacks) ? (size_t)maxCallbacks : 0);
+  bool ran = execCallbacks(timeoutSecs, runAll, loop_id, budget);
+  return Rcpp::List::create(
+    Rcpp::_["ran"]       = ran,
+    Rcpp::_["callbacks"] = (double)budget.callbacks(),
+    Rcpp::_["elapsed"]   = budget.elapsed()
+  );
+}
+
+// Reads a single number from an R option, or returns `defaultValue` if the
+// option isn't set.
+static double numericOption(const char* name, double defaultValue) {
+  SEXP value = Rf_GetOption1(Rf_install(name));
+  if (Rf_isNumeric(value) && Rf_length(value) == 1) {
+    return Rf_asReal(value);
+  }
+  return defaultValue;
+}
 
 // This function is called from the input handler on Unix, or the Windows
 // equivalent. It may throw exceptions.
@@ -259,10 +441,21 @@ bool execCallbacks(double timeoutSecs, bool runAll, int loop_id) {
 //   message(i)
 //   promise_resolve(i)
 // })
+//
+// The total amount of work can be limited with the later.top_level_budget and
+// later.top_level_max_callbacks options, so that a flood of callbacks doesn't
+// keep the console from responding. Whatever is left over runs on the next
+// call.
 bool execCallbacksForTopLevel() {
+  double maxCallbacks = numericOption("later.top_level_max_callbacks", R_PosInf);
+  ExecBudget budget(
+    numericOption("later.top_level_budget", R_PosInf),
+    R_finite(maxCallbacks) && maxCallbacks >= 1 ? (size_t)maxCallbacks : 0
+  );
+
   bool any = false;
   for (size_t i = 0; i < 20; i++) {
-    if (!execCallbacks(0, true, GLOBAL_LOOP))
+    if (budget.spent() || !execCallbacks(0, true, GLOBAL_LOOP, budget))
       return any;
     any = true;
   }
@@ -313,8 +506,69 @@ std::string execLater(Rcpp::Function callback, double delaySecs, int loop_id) {
   return toString(callback_id);
 }
 
+// Schedule an R function to run repeatedly. See CallbackRegistry::addRepeating().
+// [[Rcpp::export(rng = false)]]
+std::string execLaterEvery(Rcpp::Function callback, double intervalSecs, double delaySecs,
+                           std::string missed, int loop_id)
+{
+  ASSERT_MAIN_THREAD()
+  ensureInitialized();
+  shared_ptr<CallbackRegistry> registry = callbackRegistryTable.getRegistry(loop_id);
+  if (registry == nullptr) {
+    Rcpp::stop("CallbackRegistry does not exist.");
+  }
+  if (!(intervalSecs > 0) || !R_finite(intervalSecs)) {
+    Rcpp::stop("The interval must be a positive number of seconds.");
+  }
+
+  Callback_sp cb = allocate_callback<RcppFunctionCallback>(
+    registry->getPool(), Timestamp(delaySecs), callback
+  );
+  cb->interval = intervalSecs;
+  cb->missed = missedTickPolicyFromString(missed);
+  WakeChange change;
+  uint64_t callback_id = registry->addRepeating(cb, delaySecs, &change);
+  if (change.rootId == GLOBAL_LOOP) {
+    signalAutorunner(*change.wake);
+  }
+
+  return toString(callback_id);
+}
+
+// Schedule several R functions at once, with one call from R and one lock
+// acquisition. `delaySecs` must be the same length as `callbacks`.
+// [[Rcpp::export(rng = false)]]
+std::vector<std::string> execLaterMany(Rcpp::List callbacks, Rcpp::NumericVector delaySecs, int loop_id) {
+  ASSERT_MAIN_THREAD()
+  ensureInitialized();
+  shared_ptr<CallbackRegistry> registry = callbackRegistryTable.getRegistry(loop_id);
+  if (registry == nullptr) {
+    Rcpp::stop("CallbackRegistry does not exist.");
+  }
+  if (callbacks.size() != delaySecs.size()) {
+    Rcpp::stop("callbacks and delaySecs must be the same length.");
+  }
+  std::vector<uint64_t> callback_ids = doExecLater(registry, callbacks, delaySecs, true);
+
+  std::vector<std::string> result(callback_ids.size());
+  for (size_t i = 0; i < callback_ids.size(); i++) {
+    result[i] = toString(callback_ids[i]);
+  }
+  return result;
+}
 
 
+// Parses a callback ID that was converted to a string by execLater(). Returns
+// false if the string is not a valid ID.
+static bool parseCallbackId(const std::string& callback_id_s, uint64_t* callback_id) {
+  std::istringstream iss(callback_id_s);
+  iss >> *callback_id;
+
+  // If the input is good (just a number with no other text) then eof will be
+  // 1 and fail will be 0.
+  return iss.eof() && !iss.fail();
+}
+
 bool cancel(uint64_t callback_id, int loop_id) {
   ASSERT_MAIN_THREAD()
   shared_ptr<CallbackRegistry> registry = callbackRegistryTable.getRegistry(loop_id);
@@ -328,18 +582,34 @@ bool cancel(uint64_t callback_id, int loop_id) {
 bool cancel(std::string callback_id_s, int loop_id) {
   ASSERT_MAIN_THREAD()
   uint64_t callback_id;
-  std::istringstream iss(callback_id_s);
-  iss >> callback_id;
-
-  // If the input is good (just a number with no other text) then eof will be
-  // 1 and fail will be 0.
-  if (! (iss.eof() && !iss.fail())) {
+  if (!parseCallbackId(callback_id_s, &callback_id)) {
     return false;
   }
 
   return cancel(callback_id, loop_id);
 }
 
+// Cancel several callbacks at once. Returns a logical vector with one element
+// per ID, which is TRUE if that callback was cancelled.
+// [[Rcpp::export(rng = false)]]
+std::vector<bool> cancelMany(std::vector<std::string> callback_ids_s, int loop_id) {
+  ASSERT_MAIN_THREAD()
+  std::vector<bool> result(callback_ids_s.size(), false);
+
+  shared_ptr<CallbackRegistry> registry = callbackRegistryTable.getRegistry(loop_id);
+  if (registry == nullptr) {
+    return result;
+  }
+
+  for (size_t i = 0; i < callback_ids_s.size(); i++) {
+    uint64_t callback_id;
+    if (parseCallbackId(callback_ids_s[i], &callback_id)) {
+      result[i] = registry->cancel(callback_id);
+    }
+  }
+  return result;
+}
+
 
 
 // [[Rcpp::export(rng = false)]]
@@ -366,6 +636,41 @@ extern "C" uint64_t execLaterNative2(void (*func)(void*), void* data, double del
   return callbackRegistryTable.scheduleCallback(func, data, delaySecs, loop_id);
 }
 
+// Schedules several C functions to execute on a specific event loop. If `ids`
+// is not NULL, it must have room for `n` callback IDs. Returns the number of
+// callbacks scheduled, which is 0 if the loop does not exist.
+extern "C" int execLaterBatchNative(const later_batch_item* items, int n, uint64_t* ids, int loop_id) {
+  ensureInitialized();
+  return callbackRegistryTable.scheduleCallbacks(items, n, ids, loop_id);
+}
+
+// Schedules a C function to run repeatedly on a specific event loop, first
+// after `delaySecs` seconds and then every `intervalSecs` seconds. `missed` is
+// a MissedTickPolicy. Returns the callback ID, or 0 if the loop does not exist
+// or the interval is not positive.
+extern "C" uint64_t execLaterEveryNative(void (*func)(void*), void* data, double intervalSecs,
+                                         double delaySecs, int missed, int loop_id)
+{
+  ensureInitialized();
+  if (!(intervalSecs > 0) || !R_finite(intervalSecs)) {
+    return 0;
+  }
+  if (missed < MISSED_SKIP || missed > MISSED_CATCH_UP) {
+    missed = MISSED_SKIP;
+  }
+
+  return callbackRegistryTable.scheduleRepeating(
+    func, data, intervalSecs, delaySecs, static_cast<MissedTickPolicy>(missed), loop_id
+  );
+}
+
+// Cancels a callback on a specific event loop. Returns 1 if it was cancelled,
+// and 0 if it had already run, had already been cancelled, or the loop does
+// not exist. Must be called from the main R thread.
+extern "C" int execLaterCancelNative(uint64_t callback_id, int loop_id) {
+  return cancel(callback_id, loop_id) ? 1 : 0;
+}
+
 extern "C" int apiVersion() {
   return LATER_DLL_API_VERSION;
 }
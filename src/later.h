@@ -8,16 +8,61 @@
 // inst/include/later_api.h. Whenever the interface between
 // inst/include/later_api.h and the code in src/ changes, these values
 // should be incremented.
-#define LATER_DLL_API_VERSION 3
+#define LATER_DLL_API_VERSION 4
 
 #define GLOBAL_LOOP 0
 
+// Flags for execLaterFdNative2() and execLaterFdWatchNative(). These must
+// have the same values as in inst/include/later_api.h.
+#define LATER_FD_REVENTS 1
+
+// One callback to be scheduled by execLaterBatchNative(). This must have the
+// same layout as later::batch_item in inst/include/later_api.h.
+struct later_batch_item {
+  void (*func)(void*);
+  void* data;
+  double secs;
+};
+
 std::shared_ptr<CallbackRegistry> getGlobalRegistry();
 
+// Limits on how much work execCallbacks() does, and a record of how much it
+// has done. One budget can be shared by several calls to execCallbacks().
+class ExecBudget {
+public:
+  // No limits.
+  ExecBudget();
+  // Stop after `secs` seconds (if finite) or `maxCallbacks` callbacks (if
+  // nonzero), whichever comes first. At least one callback is always run,
+  // if any are due.
+  ExecBudget(double secs, size_t maxCallbacks);
+
+  // Start the clock. Only the first call has an effect.
+  void begin();
+  // Count a callback that is about to run.
+  void charge();
+  // Has the budget run out?
+  bool spent();
+
+  size_t callbacks() const;
+  // Seconds since begin().
+  double elapsed() const;
+
+private:
+  double secs;
+  size_t maxCallbacks;
+  bool started;
+  bool exhausted;
+  size_t count;
+  Timestamp start;
+  Optional<Timestamp> deadline;
+};
+
 bool execCallbacksForTopLevel();
 bool at_top_level();
 
 bool execCallbacks(double timeoutSecs, bool runAll, int loop_id);
+bool execCallbacks(double timeoutSecs, bool runAll, int loop_id, ExecBudget& budget);
 bool idle(int loop);
 
 void ensureInitialized();
@@ -26,6 +71,16 @@ void ensureInitialized();
 void ensureAutorunnerInitialized();
 
 uint64_t doExecLater(std::shared_ptr<CallbackRegistry> callbackRegistry, Rcpp::Function callback, double delaySecs, bool resetTimer);
-uint64_t doExecLater(std::shared_ptr<CallbackRegistry> callbackRegistry, void (*callback)(void*), void* data, double delaySecs, bool resetTimer);
+std::vector<uint64_t> doExecLater(std::shared_ptr<CallbackRegistry> callbackRegistry, const Rcpp::List& callbacks, const Rcpp::NumericVector& delaySecs, bool resetTimer);
+
+// Make sure that the mechanism which runs the event loop when the console is
+// idle will wake up no later than `when`. Can be called from any thread.
+void signalAutorunner(const Timestamp& when);
+
+// The number of times the mechanism which runs the event loop when the
+// console is idle has been woken up, the number of times it has called the
+// handler that runs callbacks, and the number of times scheduling a callback
+// has rearmed it. For benchmarking.
+void getAutorunnerCounts(uint64_t& wakeups, uint64_t& handlerCalls, uint64_t& timerArms);
 
 #endif // _LATER_H_
@@ -3,7 +3,12 @@
 #include <Rcpp.h>
 #include <R_ext/eventloop.h>
 #include <unistd.h>
+#include <atomic>
 #include <queue>
+#ifdef LATER_HAVE_TIMERFD
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#endif
 
 #include "later.h"
 #include "callback_registry.h"
@@ -42,7 +47,7 @@ static Mutex m(tct_mtx_plain);
 // The buffer we're using for the pipe. This doesn't have to be large,
 // in theory it only ever holds zero or one byte.
 static size_t BUF_SIZE = 256;
-static void *buf;
+static void *buf = NULL;
 
 void set_fd(bool ready) {
   Guard g(&m);
@@ -61,14 +66,114 @@ void set_fd(bool ready) {
   }
 }
 
+// Counters for autorunnerStats(): how many times the timer has woken up the
+// input handler, how many times the input handler has been called, and how
+// many times scheduling a callback has rearmed the timer (or, from
+// signalAutorunner(), asked for it to be rearmed).
+static std::atomic<uint64_t> timer_wakeups(0);
+static std::atomic<uint64_t> handler_calls(0);
+static std::atomic<uint64_t> timer_arms(0);
+
 namespace {
 void fd_on() {
+  ++timer_wakeups;
   set_fd(true);
 }
 
 Timer timer(fd_on);
 } // namespace
 
+#ifdef LATER_HAVE_TIMERFD
+
+// On Linux, R's input handler can watch a timerfd, which the kernel makes
+// readable at the next wake time, instead of the pipe that the Timer thread
+// writes to. Other threads that schedule a callback earlier than that write
+// to an eventfd, and the main thread rearms the timerfd when it sees it. This
+// needs no background thread and no lock. If the timerfd or eventfd can't be
+// created, the pipe and Timer thread are used instead.
+static bool use_timerfd = false;
+static int timer_fd = -1;
+static int event_fd = -1;
+static tct_thrd_t autorunner_thread;
+
+// A time later than any wake time.
+static const Timestamp never(1e30);
+
+// The time that the timerfd is armed for, or `never` if it isn't armed. Only
+// written on the main thread. Other threads read it to decide whether to
+// write to the eventfd, so while the main thread is finding the next wake
+// time, it's set to `never`: a callback scheduled in the meantime then always
+// signals, instead of possibly being missed.
+static std::atomic<Timestamp> armed_at(never);
+
+// Arm the timerfd to fire at `when`, replacing any earlier setting. Main
+// thread only.
+static void timerfd_arm(const Timestamp& when) {
+  armed_at = when;
+  // Relative to now, so that we don't rely on timerfd's clock having the
+  // same epoch as Timestamp's.
+  double secs = when.diff_secs(Timestamp());
+  if (secs > 1e8) {
+    secs = 1e8;
+  }
+  itimerspec spec = {};
+  if (secs > 0) {
+    spec.it_value.tv_sec = (time_t)secs;
+    spec.it_value.tv_nsec = (long)((secs - (double)spec.it_value.tv_sec) * 1e9);
+  }
+  // A zero it_value would disarm the timer.
+  if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+    spec.it_value.tv_nsec = 1;
+  }
+  timerfd_settime(timer_fd, 0, &spec, NULL);
+}
+
+static void timerfd_input_handler(void *data);
+static void eventfd_input_handler(void *data);
+
+#endif // LATER_HAVE_TIMERFD
+
+// Make the autorunner wake up at `when`, replacing any wake time that was set
+// before. Main thread only.
+static void wake_at(const Timestamp& when) {
+#ifdef LATER_HAVE_TIMERFD
+  if (use_timerfd) {
+    timerfd_arm(when);
+    return;
+  }
+#endif
+  timer.set(when);
+}
+
+// Like wake_at(), but only ever moves the wake time earlier. Main thread
+// only.
+static void wake_at_if_earlier(const Timestamp& when) {
+#ifdef LATER_HAVE_TIMERFD
+  if (use_timerfd) {
+    if (when < armed_at.load()) {
+      timerfd_arm(when);
+    }
+    return;
+  }
+#endif
+  timer.setIfEarlier(when);
+}
+
+// Set the wake time from the global loop's tree, after callbacks have run or
+// other threads have scheduled callbacks. This allows for slack, so that
+// callbacks due close together are run with one wakeup. Main thread only.
+static void wake_at_next_event() {
+#ifdef LATER_HAVE_TIMERFD
+  if (use_timerfd) {
+    armed_at = never;
+  }
+#endif
+  Optional<Timestamp> nextEvent = getGlobalRegistry()->nextWakeTime();
+  if (nextEvent.has_value()) {
+    wake_at(*nextEvent);
+  }
+}
+
 class ResetTimerOnExit {
 public:
   ResetTimerOnExit() {
@@ -76,17 +181,15 @@ public:
   ~ResetTimerOnExit() {
     ASSERT_MAIN_THREAD()
     // Find the next event in the registry and, if there is one, set the timer.
-    Optional<Timestamp> nextEvent = getGlobalRegistry()->nextTimestamp();
-    if (nextEvent.has_value()) {
-      timer.set(*nextEvent);
-    }
+    wake_at_next_event();
   }
 };
 
-static void async_input_handler(void *data) {
+// Run the callbacks that are due, if it's safe to, and set the next wake
+// time. Called by the input handlers after they've cleared their file
+// descriptors.
+static void run_autorunner() {
   ASSERT_MAIN_THREAD()
-  set_fd(false);
-
   if (!at_top_level()) {
     // It's not safe to run arbitrary callbacks when other R code
     // is already running. Wait until we're back at the top level.
@@ -99,7 +202,7 @@ static void async_input_handler(void *data) {
     // again in a few milliseconds. This should give enough breathing room that
     // we don't interfere with the sockets too much.
     // shikokuchuo 2026-02-07: reduced to just one millisecond
-    timer.set(Timestamp(0.001));
+    wake_at(Timestamp(0.001));
     return;
   }
 
@@ -123,15 +226,15 @@ static void async_input_handler(void *data) {
     execCallbacksForTopLevel();
   }
   catch(Rcpp::internal::InterruptedException &e) {
-    DEBUG_LOG("async_input_handler: caught Rcpp::internal::InterruptedException", LOG_INFO);
+    DEBUG_LOG("run_autorunner: caught Rcpp::internal::InterruptedException", LOG_INFO);
     REprintf("later: interrupt occurred while executing callback.\n");
   }
   catch(Rcpp::LongjumpException& e){
-    DEBUG_LOG("async_input_handler: caught exception", LOG_INFO);
+    DEBUG_LOG("run_autorunner: caught exception", LOG_INFO);
     REprintf("later: exception occurred while executing callback.\n");
   }
   catch(std::exception& e){
-    DEBUG_LOG("async_input_handler: caught exception", LOG_INFO);
+    DEBUG_LOG("run_autorunner: caught exception", LOG_INFO);
     std::string msg = "later: exception occurred while executing callback: \n";
     msg += e.what();
     msg += "\n";
@@ -142,8 +245,46 @@ static void async_input_handler(void *data) {
   }
 }
 
+static void async_input_handler(void *data) {
+  ASSERT_MAIN_THREAD()
+  ++handler_calls;
+  set_fd(false);
+  run_autorunner();
+}
+
+#ifdef LATER_HAVE_TIMERFD
+
+static void timerfd_input_handler(void *data) {
+  ASSERT_MAIN_THREAD()
+  ++handler_calls;
+  uint64_t expirations = 0;
+  if (read(timer_fd, &expirations, sizeof(expirations)) > 0 && expirations > 0) {
+    ++timer_wakeups;
+  }
+  // A one-shot timer isn't armed anymore once it has fired.
+  armed_at = never;
+  run_autorunner();
+}
+
+// Another thread scheduled a callback that may be earlier than the timerfd's
+// wake time.
+static void eventfd_input_handler(void *data) {
+  ASSERT_MAIN_THREAD()
+  ++handler_calls;
+  uint64_t count;
+  if (read(event_fd, &count, sizeof(count)) < 0) {
+    // Nothing to read; another call has already handled it.
+  }
+  wake_at_next_event();
+}
+
+#endif // LATER_HAVE_TIMERFD
+
 static InputHandler* inputHandlerHandle;
 static InputHandler* dummyInputHandlerHandle;
+#ifdef LATER_HAVE_TIMERFD
+static InputHandler* eventInputHandlerHandle;
+#endif
 
 // If the real input handler has been removed, the dummy input handler removes
 // itself. The real input handler cannot remove both; otherwise a segfault
@@ -161,20 +302,41 @@ static void remove_dummy_handler(void *data) {
   }
 }
 
+// Remove the input handlers that run callbacks, and close their file
+// descriptors.
+static void remove_input_handlers() {
+  removeInputHandler(&R_InputHandlers, inputHandlerHandle);
+#ifdef LATER_HAVE_TIMERFD
+  if (use_timerfd) {
+    removeInputHandler(&R_InputHandlers, eventInputHandlerHandle);
+    if (timer_fd > 0) {
+      close(timer_fd);
+      timer_fd = -1;
+    }
+    if (event_fd > 0) {
+      close(event_fd);
+      event_fd = -1;
+    }
+    use_timerfd = false;
+    armed_at = never;
+    return;
+  }
+#endif
+  if (pipe_in  > 0) {
+    close(pipe_in);
+    pipe_in = -1;
+  }
+  if (pipe_out > 0) {
+    close(pipe_out);
+    pipe_out = -1;
+  }
+}
+
 // Callback to run in child process after forking.
 void child_proc_after_fork() {
   ASSERT_MAIN_THREAD()
   if (initialized) {
-    removeInputHandler(&R_InputHandlers, inputHandlerHandle);
-
-    if (pipe_in  > 0) {
-      close(pipe_in);
-      pipe_in = -1;
-    }
-    if (pipe_out > 0) {
-      close(pipe_out);
-      pipe_out = -1;
-    }
+    remove_input_handlers();
 
     removeInputHandler(&R_InputHandlers, dummyInputHandlerHandle);
     if (dummy_pipe_in  > 0) {
@@ -190,20 +352,50 @@ void child_proc_after_fork() {
   }
 }
 
+#ifdef LATER_HAVE_TIMERFD
+// Create the timerfd and eventfd and add their input handlers. Returns false,
+// having cleaned up, if either can't be created.
+static bool init_timerfd() {
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd < 0) {
+    return false;
+  }
+  event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (event_fd < 0) {
+    close(timer_fd);
+    timer_fd = -1;
+    return false;
+  }
+
+  autorunner_thread = tct_thrd_current();
+  armed_at = never;
+  use_timerfd = true;
+  inputHandlerHandle = addInputHandler(R_InputHandlers, timer_fd, timerfd_input_handler, LATER_ACTIVITY);
+  eventInputHandlerHandle = addInputHandler(R_InputHandlers, event_fd, eventfd_input_handler, LATER_ACTIVITY);
+  return true;
+}
+#endif
+
 void ensureAutorunnerInitialized() {
   if (!initialized) {
-    buf = malloc(BUF_SIZE);
+#ifdef LATER_HAVE_TIMERFD
+    if (!init_timerfd())
+#endif
+    {
+      if (buf == NULL) {
+        buf = malloc(BUF_SIZE);
+      }
 
-    int pipes[2];
-    if (pipe(pipes)) {
-      free(buf);
-      Rcpp::stop("Failed to create pipe");
-      return;
-    }
-    pipe_out = pipes[0];
-    pipe_in = pipes[1];
+      int pipes[2];
+      if (pipe(pipes)) {
+        Rcpp::stop("Failed to create pipe");
+        return;
+      }
+      pipe_out = pipes[0];
+      pipe_in = pipes[1];
 
-    inputHandlerHandle = addInputHandler(R_InputHandlers, pipe_out, async_input_handler, LATER_ACTIVITY);
+      inputHandlerHandle = addInputHandler(R_InputHandlers, pipe_out, async_input_handler, LATER_ACTIVITY);
+    }
 
    // If the R process is forked, make sure that the child process doesn't mess
    // with the pipes. This also means that functions scheduled in the child
@@ -233,15 +425,7 @@ void ensureAutorunnerInitialized() {
 void deInitialize() {
   ASSERT_MAIN_THREAD()
   if (initialized) {
-    removeInputHandler(&R_InputHandlers, inputHandlerHandle);
-    if (pipe_in  > 0) {
-      close(pipe_in);
-      pipe_in = -1;
-    }
-    if (pipe_out > 0) {
-      close(pipe_out);
-      pipe_out = -1;
-    }
+    remove_input_handlers();
     initialized = 0;
 
     // Trigger remove_dummy_handler()
@@ -253,25 +437,59 @@ void deInitialize() {
 
 uint64_t doExecLater(std::shared_ptr<CallbackRegistry> callbackRegistry, Rcpp::Function callback, double delaySecs, bool resetTimer) {
   ASSERT_MAIN_THREAD()
-  uint64_t callback_id = callbackRegistry->add(callback, delaySecs);
-
-  // The timer needs to be reset only if we're using the global loop, because
-  // this usage of the timer is relevant only when the event loop is driven by
-  // R's input handler (at the idle console), and only the global loop is by
-  // that.
-  if (resetTimer)
-    timer.set(*(callbackRegistry->nextTimestamp()));
+  WakeChange change;
+  uint64_t callback_id = callbackRegistry->add(callback, delaySecs, &change);
+
+  // The timer needs to be reset only if the callback moved the wake time of
+  // the global loop's tree earlier, because this usage of the timer is
+  // relevant only when the event loop is driven by R's input handler (at the
+  // idle console), and only the global loop and its descendants are run by
+  // that. Most callbacks are added behind the earliest one, and then the timer
+  // is left alone.
+  if (resetTimer && change.rootId == GLOBAL_LOOP) {
+    ++timer_arms;
+    wake_at_if_earlier(*change.wake);
+  }
 
   return callback_id;
 }
 
-uint64_t doExecLater(std::shared_ptr<CallbackRegistry> callbackRegistry, void (*callback)(void*), void* data, double delaySecs, bool resetTimer) {
-  uint64_t callback_id = callbackRegistry->add(callback, data, delaySecs);
+std::vector<uint64_t> doExecLater(std::shared_ptr<CallbackRegistry> callbackRegistry, const Rcpp::List& callbacks, const Rcpp::NumericVector& delaySecs, bool resetTimer) {
+  ASSERT_MAIN_THREAD()
+  WakeChange change;
+  std::vector<uint64_t> callback_ids = callbackRegistry->add(callbacks, delaySecs, &change);
 
-  if (resetTimer)
-    timer.set(*(callbackRegistry->nextTimestamp()));
+  if (resetTimer && change.rootId == GLOBAL_LOOP) {
+    ++timer_arms;
+    wake_at_if_earlier(*change.wake);
+  }
 
-  return callback_id;
+  return callback_ids;
+}
+
+void getAutorunnerCounts(uint64_t& wakeups, uint64_t& handlerCalls, uint64_t& timerArms) {
+  wakeups = timer_wakeups.load();
+  handlerCalls = handler_calls.load();
+  timerArms = timer_arms.load();
+}
+
+void signalAutorunner(const Timestamp& when) {
+  ++timer_arms;
+#ifdef LATER_HAVE_TIMERFD
+  if (use_timerfd) {
+    if (tct_thrd_equal(tct_thrd_current(), autorunner_thread)) {
+      wake_at_if_earlier(when);
+    } else if (when < armed_at.load() && event_fd >= 0) {
+      uint64_t one = 1;
+      ssize_t cbytes = write(event_fd, &one, sizeof(one));
+      (void)cbytes; // squelch compiler warning
+    }
+    return;
+  }
+#endif
+  // Don't overwrite an earlier wake time that was set for some other
+  // callback.
+  timer.setIfEarlier(when);
 }
 
 #endif // ifndef _WIN32
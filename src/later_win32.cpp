@@ -3,6 +3,7 @@
 #include "later.h"
 
 #include <Rcpp.h>
+#include <atomic>
 #include <queue>
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
@@ -22,10 +23,14 @@ static UINT_PTR TIMER_ID = 1;
 // The window message we use to run SetTimer on the main thread
 static const UINT WM_SETUPTIMER = WM_USER + 101;
 
+// Whether the timer is running. Only used on the main thread.
+static bool timer_running = false;
+
 static void setupTimer() {
   if (!SetTimer(hwnd, TIMER_ID, USER_TIMER_MINIMUM, NULL)) {
     (Rf_error)("Failed to schedule callback timer");
   }
+  timer_running = true;
 }
 
 static bool executeHandlers() {
@@ -66,11 +71,19 @@ static bool executeHandlers() {
   return idle(GLOBAL_LOOP);
 }
 
+// Counters for autorunnerStats(). On Windows, each timer tick is both a wakeup
+// and a call to the handler. Callbacks can be scheduled from any thread, so
+// timer_arms is atomic.
+static uint64_t timer_ticks = 0;
+static std::atomic<uint64_t> timer_arms(0);
+
 LRESULT CALLBACK callbackWndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam) {
   switch (message) {
   case WM_TIMER:
+    timer_ticks++;
     if (executeHandlers()) {
       KillTimer(hwnd, TIMER_ID);
+      timer_running = false;
     }
     break;
   case WM_SETUPTIMER:
@@ -104,28 +117,49 @@ void ensureAutorunnerInitialized() {
 }
 
 uint64_t doExecLater(std::shared_ptr<CallbackRegistry> callbackRegistry, Rcpp::Function callback, double delaySecs, bool resetTimer) {
-  uint64_t callback_id = callbackRegistry->add(callback, delaySecs);
-
-  if (resetTimer)
+  // The timer only needs to be set up if the callback moved the wake time of
+  // the global loop's tree earlier, or if it has been stopped because the
+  // global loop was idle.
+  WakeChange change;
+  uint64_t callback_id = callbackRegistry->add(callback, delaySecs, &change);
+
+  if (resetTimer && (change.rootId == GLOBAL_LOOP || !timer_running)) {
+    timer_arms++;
     setupTimer();
+  }
 
   return callback_id;
 }
 
-uint64_t doExecLater(std::shared_ptr<CallbackRegistry> callbackRegistry, void (*func)(void*), void* data, double delaySecs, bool resetTimer) {
-  uint64_t callback_id = callbackRegistry->add(func, data, delaySecs);
+std::vector<uint64_t> doExecLater(std::shared_ptr<CallbackRegistry> callbackRegistry, const Rcpp::List& callbacks, const Rcpp::NumericVector& delaySecs, bool resetTimer) {
+  WakeChange change;
+  std::vector<uint64_t> callback_ids = callbackRegistry->add(callbacks, delaySecs, &change);
 
-  if (resetTimer) {
-    if (GetCurrentThreadId() == GetWindowThreadProcessId(hwnd, NULL)) {
-      setupTimer();
-    } else {
-      // Not safe to setup the timer from this thread. Instead, send a
-      // message to the main thread that the timer should be set up.
-      PostMessage(hwnd, WM_SETUPTIMER, 0, 0);
-    }
+  if (resetTimer && (change.rootId == GLOBAL_LOOP || !timer_running)) {
+    timer_arms++;
+    setupTimer();
   }
 
-  return callback_id;
+  return callback_ids;
+}
+
+void getAutorunnerCounts(uint64_t& wakeups, uint64_t& handlerCalls, uint64_t& timerArms) {
+  wakeups = timer_ticks;
+  handlerCalls = timer_ticks;
+  timerArms = timer_arms.load();
+}
+
+void signalAutorunner(const Timestamp& when) {
+  timer_arms++;
+  // The timer polls at USER_TIMER_MINIMUM until the loop is idle, so `when`
+  // isn't needed here.
+  if (GetCurrentThreadId() == GetWindowThreadProcessId(hwnd, NULL)) {
+    setupTimer();
+  } else {
+    // Not safe to setup the timer from this thread. Instead, send a
+    // message to the main thread that the timer should be set up.
+    PostMessage(hwnd, WM_SETUPTIMER, 0, 0);
+  }
 }
 
 #endif // ifdef _WIN32
@@ -64,18 +64,33 @@ Timer::~Timer() {
   }
 }
 
-void Timer::set(const Timestamp& timestamp) {
-  Guard guard(&this->mutex);
-
+// Must be called with the mutex held.
+void Timer::ensureThread() {
   // If the thread has not yet been created, created it.
   if (!this->bgthread.has_value()) {
     tct_thrd_t thread;
     tct_thrd_create(&thread, &bg_main_func, this);
     this->bgthread = thread;
   }
+}
+
+void Timer::set(const Timestamp& timestamp) {
+  Guard guard(&this->mutex);
+  ensureThread();
 
   this->wakeAt = timestamp;
   this->cond.signal();
 }
 
+void Timer::setIfEarlier(const Timestamp& timestamp) {
+  Guard guard(&this->mutex);
+  ensureThread();
+
+  if (this->wakeAt.has_value() && !(timestamp < *this->wakeAt)) {
+    return;
+  }
+  this->wakeAt = timestamp;
+  this->cond.signal();
+}
+
 #endif // _WIN32
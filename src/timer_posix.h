@@ -21,6 +21,7 @@ class Timer {
 
   static int bg_main_func(void*);
   void bg_main();
+  void ensureThread();
 public:
   Timer(const std::function<void ()>& callback);
   virtual ~Timer();
@@ -30,6 +31,11 @@ public:
   // be overwritten with this one (the timer only tracks one
   // timestamp at a time).
   void set(const Timestamp& timestamp);
+
+  // Like set(), but only ever moves the wake time earlier. If the timer is
+  // already scheduled to fire at or before the specified time, this does
+  // nothing.
+  void setIfEarlier(const Timestamp& timestamp);
 };
 
 
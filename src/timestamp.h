@@ -1,42 +1,73 @@
 #ifndef _TIMESTAMP_H_
 #define _TIMESTAMP_H_
 
-#include <memory>
-
-// Impl abstract class; implemented by platform-specific classes
-class TimestampImpl {
-public:
-  virtual ~TimestampImpl() {}
-  virtual bool future() const = 0;
-  virtual bool less(const TimestampImpl* other) const = 0;
-  virtual bool greater(const TimestampImpl* other) const = 0;
-  virtual double diff_secs(const TimestampImpl* other) const = 0;
-};
+#include <stdint.h>
 
+// A point in time on a monotonic clock, stored as a count of nanoseconds.
+// The epoch is platform-specific (and arbitrary), so only comparisons and
+// differences between Timestamps are meaningful.
+//
+// This is a plain value type: it is trivially copyable and doesn't allocate,
+// so it's cheap to store one per callback and to compare them when ordering
+// the callback queue.
 class Timestamp {
 private:
-  std::shared_ptr<const TimestampImpl> p_impl;
+  int64_t ns;
+
+  // Current time, in nanoseconds. Implemented by platform-specific code in
+  // timestamp_unix.cpp and timestamp_win32.cpp.
+  static int64_t now_ns();
+
+  // Add `secs` seconds to `base`, saturating instead of overflowing. Callers
+  // use very large values (e.g. 3e10 seconds) to mean "forever", which would
+  // otherwise not fit in 64 bits of nanoseconds. NaN, which is what an NA
+  // delay from R becomes, is treated as 0, since converting it to an integer
+  // is undefined.
+  static int64_t add_secs(int64_t base, double secs) {
+    if (secs != secs) {
+      return base;
+    }
+    double result = (double)base + secs * 1e9;
+    if (result >= 9.2e18) {
+      return INT64_MAX;
+    } else if (result <= -9.2e18) {
+      return INT64_MIN;
+    }
+    return base + (int64_t)(secs * 1e9);
+  }
 
 public:
-  Timestamp();
-  Timestamp(double secs);
+  Timestamp() : ns(now_ns()) {}
+  Timestamp(double secs) : ns(add_secs(now_ns(), secs)) {}
+
+  // This timestamp plus `secs` seconds.
+  Timestamp plus_secs(double secs) const {
+    Timestamp result(*this);
+    result.ns = add_secs(ns, secs);
+    return result;
+  }
 
   // Is this timestamp in the future?
   bool future() const {
-    return p_impl->future();
+    return ns > now_ns();
   }
 
   // Comparison operators
   bool operator<(const Timestamp& other) const {
-    return p_impl->less(other.p_impl.get());
+    return ns < other.ns;
   }
   bool operator>(const Timestamp& other) const {
-    return p_impl->greater(other.p_impl.get());
+    return ns > other.ns;
   }
 
-  // Diff
+  // Diff. If either timestamp is saturated, the difference in nanoseconds may
+  // not fit in 64 bits, so it's taken in doubles instead.
   double diff_secs(const Timestamp& other) const {
-    return p_impl->diff_secs(other.p_impl.get());
+    if ((other.ns < 0 && ns > INT64_MAX + other.ns) ||
+        (other.ns > 0 && ns < INT64_MIN + other.ns)) {
+      return ((double)ns - (double)other.ns) / 1e9;
+    }
+    return (double)(ns - other.ns) / 1e9;
   }
 };
 